@@ -1,26 +1,29 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
 #include "analyzer.h"
 #include "ast_visitor.h"
 #include "sym_table.h"
+#include "line_index.h"
+#include "compiler_ctx.h"
 
 
-sym_table_t* g_sym_table;
-char* g_current_func;
-bool error;
-
 /*
 static print_error(uint32_t line, const char* msg) {
     fprintf(stderr, "Line: %d: error: %s is not a function\n", sym);
 }
 */
 
-static bool is_callable(ast_node_t* node) {
+static bool is_callable(analyzer_t* analyzer, ast_node_t* node,
+    sym_entry_t* entry) {
     bool status = false;
-    char* sym = node->as.funccall.ident->as.ident.value;
-    sym_entry_t* entry = sym_lookup(g_sym_table, sym);
     if (entry != NULL) {
         if (entry->type != SYM_FUNC) {
-            fprintf(stderr, "Line: %d: error: \"%s\" is not a function\n",
-                node->line, sym);
+            print_location(analyzer->err, analyzer->line_index, node->offset);
+            fprintf(analyzer->err, "error: \"%s\" is not a function\n",
+                entry->sym->name);
             status = false;
         }
         status = true;
@@ -28,37 +31,29 @@ static bool is_callable(ast_node_t* node) {
     return status;
 }
 
-static bool number_of_params_match(ast_node_t *node) {
+static bool number_of_params_match(analyzer_t* analyzer, ast_node_t *node,
+    sym_entry_t* entry) {
     bool status = true;
-    char* sym = node->as.funccall.ident->as.ident.value;
-    sym_entry_t* entry = sym_lookup(g_sym_table, sym);
      if (entry != NULL) {
         ast_node_t* params = node->as.funccall.params;
-        ast_node_t* param = params->as.paramslist.list->head;
-        int count = 0;
-        while (param) {
-            param = param->next;
-            count++;
-        }
+        int count = (int)params->as.paramslist.list.count;
         if (count != entry->as.func.n_params) {
-            fprintf(stderr,
-                "Line: %d: error: wrong number of params for \"%s\", expected %d given %d\n",
-                node->line, sym, entry->as.func.n_params, count);
+            print_location(analyzer->err, analyzer->line_index, node->offset);
+            fprintf(analyzer->err,
+                "error: wrong number of params for \"%s\", expected %d given %d\n",
+                entry->sym->name, entry->as.func.n_params, count);
             status = false;
         }
     }
     return status;
 }
 
-sym_entry_t* param_entry(char* func_name, ast_node_t* node) {
-    sym_entry_t* entry = NULL;
-    sym_entry_t* func_entry = sym_lookup(g_sym_table, func_name);
-    if (func_entry != NULL) {
-        entry = sym_lookup(func_entry->as.func.sym_table, node->as.ident.value);
-        if (entry == NULL) {
-            entry = sym_lookup(g_sym_table, node->as.ident.value);
-        }
-    }
+// Names are bound while parsing, only globals used before their
+// declaration are looked up here.
+static sym_entry_t* param_entry(analyzer_t* analyzer, ast_node_t* node) {
+    sym_entry_t* entry = node->as.ident.entry;
+    if (entry == NULL)
+        entry = sym_lookup(analyzer->sym_table, node->as.ident.atom);
     return entry;
 }
 
@@ -78,40 +73,40 @@ static char *param_to_str(sym_entry_t* entry) {
     return "unkown";
 }
 
-static bool params_match(ast_node_t *node) {
+static bool params_match(analyzer_t* analyzer, ast_node_t *node,
+    sym_entry_t* entry) {
     bool status = true;
-    char* sym = node->as.funccall.ident->as.ident.value;
-    sym_entry_t* entry = sym_lookup(g_sym_table, sym);
     if (entry != NULL) {
-        ast_node_t* params = node->as.funccall.params;
-        ast_node_t* param = params->as.paramslist.list->head;
+        ast_node_list_t* params =
+            &node->as.funccall.params->as.paramslist.list;
 
         int i = 0;
-        while (param) {
+        for (uint32_t k = 0; k < params->count; k++) {
+            ast_node_t* param = params->items[k];
             if (param->type != NODE_IDENT) { // Only checking ident for now
-                param = param->next;
                 continue;
             }
 
-            sym_entry_t* given = param_entry(g_current_func, param);
+            sym_entry_t* given = param_entry(analyzer, param);
             sym_entry_t* expected = entry->as.func.params[i];
 
             if ((given->as.var.is_array != expected->as.var.is_array)) {
-                fprintf(stderr,
-                "Line: %d: error: parameter mismatch for \"%s\", expected %s given %s\n",
-                node->line, sym, param_to_str(expected), param_to_str(given));
+                print_location(analyzer->err, analyzer->line_index, node->offset);
+                fprintf(analyzer->err,
+                "error: parameter mismatch for \"%s\", expected %s given %s\n",
+                entry->sym->name, param_to_str(expected), param_to_str(given));
                 return false;
             }
 
             if ((given->as.var.is_array == expected->as.var.is_array) &&
                 (given->as.var.type != expected->as.var.type)) {
-                    fprintf(stderr,
-                    "Line: %d: error: parameter mismatch for \"%s\", expected %s given %s\n",
-                    node->line, sym, param_to_str(expected), param_to_str(given));
+                    print_location(analyzer->err, analyzer->line_index, node->offset);
+                    fprintf(analyzer->err,
+                    "error: parameter mismatch for \"%s\", expected %s given %s\n",
+                    entry->sym->name, param_to_str(expected), param_to_str(given));
                     return false;
             }
 
-            param = param->next;
             i++;
         }
 
@@ -120,42 +115,162 @@ static bool params_match(ast_node_t *node) {
     return status;
 }
 
-static void analyze_funccall(ast_node_t* node) {
-    if (is_callable(node) == false) {
-        error = true;
+static void analyze_funccall(analyzer_t* analyzer, ast_node_t* node) {
+    sym_entry_t* entry = node->as.funccall.entry;
+    if (entry == NULL) {
+        entry = sym_lookup(analyzer->sym_table,
+            node->as.funccall.ident->as.ident.atom);
+    }
+    if (is_callable(analyzer, node, entry) == false) {
+        analyzer->error = true;
         return;
     }
-    if (number_of_params_match(node) == false) {
-        error = true;
+    if (number_of_params_match(analyzer, node, entry) == false) {
+        analyzer->error = true;
         return;
     }
-    if (params_match(node) == false) {
-        error = true;
+    if (params_match(analyzer, node, entry) == false) {
+        analyzer->error = true;
         return;
     }
 }
 
-static void start_funccall_analysis(ast_node_t* node) {
-    if (node->type == NODE_FUNCCALL) {
-        analyze_funccall(node);
-    }
+static bool check_funccall(const ast_visit_t* visit, void* data) {
+    analyze_funccall(data, visit->node);
+    return true;
+}
+
+static void init_analyzer(analyzer_t* analyzer, sym_table_t* sym_table,
+    line_index_t* line_index, FILE* err) {
+    analyzer->error = false;
+    analyzer->sym_table = sym_table;
+    analyzer->line_index = line_index;
+    analyzer->err = err;
 }
 
-void start_analyze_funcdecl(ast_node_t* node) {
-    g_current_func = node->as.funcdecl.ident->as.ident.value;
-    visit_ast(node, start_funccall_analysis);
+// Runs every check in the same walk of the tree below node.
+static void analyze_node(analyzer_t* analyzer, ast_node_t* node) {
+    const ast_pass_t passes[] = {
+        { NODE_BIT(NODE_FUNCCALL), check_funccall, NULL, analyzer },
+    };
+    walk_passes(node, passes, sizeof(passes) / sizeof(passes[0]));
 }
 
-void start_analysis_callback(ast_node_t* node) {
-    if (node->type == NODE_FUNCDECL) {
-        start_analyze_funcdecl(node);
+// Where the diagnostics of one top level statement were written: a range
+// of the error stream of the worker that analyzed it.
+typedef struct {
+    uint32_t worker;
+    long begin;
+    long end;
+} analysis_task_t;
+
+// The top level statements, taken in turn by the workers of
+// analyze_parallel().
+typedef struct {
+    ast_node_list_t* stmts;
+    analysis_task_t* tasks;
+    atomic_uint next_stmt;
+} analysis_queue_t;
+
+// A worker writes its diagnostics to its own stream, and builds its own
+// line index if it has any to write.
+typedef struct {
+    analysis_queue_t* queue;
+    uint32_t index;
+    analyzer_t analyzer;
+    line_index_t line_index;
+    char* err;
+    size_t err_size;
+} analysis_worker_t;
+
+static void* analysis_worker(void* arg) {
+    analysis_worker_t* worker = arg;
+    analysis_queue_t* queue = worker->queue;
+    FILE* err = worker->analyzer.err;
+
+    for (;;) {
+        uint32_t k = atomic_fetch_add(&queue->next_stmt, 1);
+        if (k >= queue->stmts->count)
+            break;
+        analysis_task_t* task = &queue->tasks[k];
+        task->worker = worker->index;
+        task->begin = ftell(err);
+        analyze_node(&worker->analyzer, queue->stmts->items[k]);
+        task->end = ftell(err);
     }
+    return NULL;
 }
 
-bool has_semantic_errors(ast_node_t* ast, sym_table_t *sym_table) {
-    error = false;
-    g_sym_table = sym_table;
-    visit_ast(ast, start_analysis_callback);
+// Analyzes each function, and any other top level statement, as its own
+// task on up to jobs threads. The checks only read the AST and the global
+// symbols, so the tasks share them. Diagnostics are written out in source
+// order once every task is done.
+static bool analyze_parallel(compiler_ctx_t* ctx, ast_node_list_t* stmts,
+    sym_table_t* sym_table, uint32_t jobs) {
+    analysis_queue_t queue;
+    queue.stmts = stmts;
+    queue.tasks = calloc(stmts->count, sizeof(analysis_task_t));
+    atomic_init(&queue.next_stmt, 0);
+
+    analysis_worker_t* workers = calloc(jobs, sizeof(analysis_worker_t));
+    pthread_t* threads = calloc(jobs, sizeof(pthread_t));
+    if (queue.tasks == NULL || workers == NULL || threads == NULL) {
+        fprintf(stderr, "Could not allocate memory for analysis workers\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < jobs; i++) {
+        analysis_worker_t* worker = &workers[i];
+        worker->queue = &queue;
+        worker->index = i;
+        worker->line_index = ctx->line_index;
+        init_analyzer(&worker->analyzer, sym_table, &worker->line_index,
+            open_memstream(&worker->err, &worker->err_size));
+    }
+
+    uint32_t started = 1;
+    for (; started < jobs; started++) {
+        if (pthread_create(&threads[started], NULL, analysis_worker,
+                &workers[started]) != 0)
+            break;
+    }
+    analysis_worker(&workers[0]);
+    for (uint32_t i = 1; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    bool error = false;
+    for (uint32_t i = 0; i < jobs; i++) {
+        fclose(workers[i].analyzer.err);
+        error |= workers[i].analyzer.error;
+    }
+    for (uint32_t k = 0; k < stmts->count; k++) {
+        analysis_task_t* task = &queue.tasks[k];
+        fwrite(workers[task->worker].err + task->begin, 1,
+            (size_t)(task->end - task->begin), ctx->err);
+    }
+    for (uint32_t i = 0; i < jobs; i++) {
+        if (workers[i].line_index.starts != ctx->line_index.starts)
+            free_line_index(&workers[i].line_index);
+        free(workers[i].err);
+    }
+    free(threads);
+    free(workers);
+    free(queue.tasks);
     return error;
 }
 
+bool has_semantic_errors(compiler_ctx_t* ctx, ast_node_t* ast,
+    sym_table_t *sym_table, uint32_t jobs) {
+    analyzer_t* analyzer = &ctx->analyzer;
+    init_analyzer(analyzer, sym_table, &ctx->line_index, ctx->err);
+    if (ast != NULL && ast->type == NODE_ROOT && jobs > 1) {
+        ast_node_list_t* stmts = &ast->as.root.stmts->as.stmtslist.list;
+        if (stmts->count < jobs)
+            jobs = stmts->count;
+        if (jobs > 1) {
+            analyzer->error = analyze_parallel(ctx, stmts, sym_table, jobs);
+            return analyzer->error;
+        }
+    }
+    analyze_node(analyzer, ast);
+    return analyzer->error;
+}
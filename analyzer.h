@@ -4,9 +4,21 @@
 #include "parser.h"
 #include "ast.h"
 #include "sym_table.h"
+#include "line_index.h"
 
+typedef struct compiler_ctx compiler_ctx_t;
 
-bool has_semantic_errors(ast_node_t* ast, sym_table_t *sym_table);
+typedef struct {
+    sym_table_t* sym_table;
+    line_index_t* line_index;
+    FILE* err;
+    bool error;
+} analyzer_t;
+
+// Checks the calls in the tree, the bodies of separate functions on up to
+// jobs threads. Diagnostics are printed in source order either way.
+bool has_semantic_errors(compiler_ctx_t* ctx, ast_node_t* ast,
+    sym_table_t *sym_table, uint32_t jobs);
 
 
 #endif
\ No newline at end of file
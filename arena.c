@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+static void new_block(arena_t* arena, size_t size) {
+    if (size < ARENA_BLOCK_SIZE)
+        size = ARENA_BLOCK_SIZE;
+    // calloc hands back zeroed memory, usually fresh pages, so allocations
+    // need no memset.
+    arena_block_t* block = calloc(1, sizeof(arena_block_t) + size);
+    if (block == NULL) {
+        fprintf(stderr, "Could not allocate memory for arena\n");
+        exit(EXIT_FAILURE);
+    }
+    block->prev = arena->block;
+    block->size = size;
+    arena->block = block;
+    arena->next = block->data;
+    arena->end = block->data + size;
+    arena->blocks++;
+}
+
+// Returns zeroed memory.
+void* arena_alloc(arena_t* arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if (arena->next == NULL || (size_t)(arena->end - arena->next) < size)
+        new_block(arena, size);
+    void* ptr = arena->next;
+    arena->next += size;
+    arena->allocations++;
+    arena->bytes += size;
+    return ptr;
+}
+
+char* arena_strndup(arena_t* arena, const char* str, size_t length) {
+    char* s = arena_alloc(arena, length + 1);
+    memcpy(s, str, length);
+    return s;
+}
+
+// Moves the blocks of from into arena, so they are freed with it. from is
+// left empty. Allocation goes on in the current block of arena.
+void adopt_arena(arena_t* arena, arena_t* from) {
+    if (from->block == NULL)
+        return;
+    if (arena->block == NULL) {
+        *arena = *from;
+    } else {
+        arena_block_t* oldest = from->block;
+        while (oldest->prev != NULL)
+            oldest = oldest->prev;
+        oldest->prev = arena->block->prev;
+        arena->block->prev = from->block;
+        arena->allocations += from->allocations;
+        arena->bytes += from->bytes;
+        arena->blocks += from->blocks;
+    }
+    memset(from, 0, sizeof(arena_t));
+}
+
+void free_arena(arena_t* arena) {
+    arena_block_t* block = arena->block;
+    while (block != NULL) {
+        arena_block_t* prev = block->prev;
+        free(block);
+        block = prev;
+    }
+    memset(arena, 0, sizeof(arena_t));
+}
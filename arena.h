@@ -0,0 +1,35 @@
+#ifndef cmm_arena_h
+#define cmm_arena_h
+
+#include <stddef.h>
+
+// Blocks are at least this large, bigger requests get a block of their own.
+#define ARENA_BLOCK_SIZE (64 * 1024)
+// Every allocation starts on this boundary, enough for the AST structs.
+#define ARENA_ALIGNMENT 8
+
+typedef struct arena_block {
+    struct arena_block* prev;
+    size_t size;
+    char data[];
+} arena_block_t;
+
+// Bump allocator for what lives as long as one compilation: AST nodes, their
+// lists and the lexemes they keep. Nothing is freed on its own, free_arena()
+// releases every block at once.
+typedef struct {
+    arena_block_t* block;
+    char* next;
+    char* end;
+    // What was asked for, reported by --stats.
+    size_t allocations;
+    size_t bytes;
+    size_t blocks;
+} arena_t;
+
+void* arena_alloc(arena_t* arena, size_t size);
+char* arena_strndup(arena_t* arena, const char* str, size_t length);
+void adopt_arena(arena_t* arena, arena_t* from);
+void free_arena(arena_t* arena);
+
+#endif
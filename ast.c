@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdbool.h>
 #include "ast.h"
@@ -32,181 +33,173 @@ static op_t tokentype_to_op(token_type_t type) {
     else return -1;
 }
 
-static char* lexeme(token_t* token) {
-    char *s = malloc(token->length+1);
-    if (s == NULL) {
-        fprintf(stderr, "Could not allocate memory for lexeme\n");
-        exit(EXIT_FAILURE);
+#define NODE_SIZE(member) \
+    (offsetof(ast_node_t, as) + sizeof(((ast_node_t*)NULL)->as.member))
+
+static size_t node_size(ast_node_type_t type) {
+    switch (type) {
+        case NODE_ROOT:           return NODE_SIZE(root);
+        case NODE_STMTSLIST:      return NODE_SIZE(stmtslist);
+        case NODE_INT:            return NODE_SIZE(number);
+        case NODE_CHAR:           return NODE_SIZE(character);
+        case NODE_STRING:         return NODE_SIZE(string);
+        case NODE_IDENT:          return NODE_SIZE(ident);
+        case NODE_UNARYOP:        return NODE_SIZE(unary);
+        case NODE_BINOP:          return NODE_SIZE(binary);
+        case NODE_FUNCDECL:       return NODE_SIZE(funcdecl);
+        case NODE_PARAMDECL:      return NODE_SIZE(paramdecl);
+        case NODE_PARAMDECL_LIST: return NODE_SIZE(paramsdecllist);
+        case NODE_FUNCCALL:       return NODE_SIZE(funccall);
+        case NODE_PARAM_LIST:     return NODE_SIZE(paramslist);
+        case NODE_IF:             return NODE_SIZE(ifstmt);
+        case NODE_FOR:            return NODE_SIZE(forstmt);
+        case NODE_WHILE:          return NODE_SIZE(whilestmt);
+        case NODE_RETURN:         return NODE_SIZE(_return);
+        case NODE_ASSIGN:         return NODE_SIZE(assign);
+        case NODE_ARRAYACCESS:    return NODE_SIZE(arrayaccess);
+        case NODE_VARDECL:        return NODE_SIZE(vardecl);
+        default:                  return sizeof(ast_node_t);
     }
-    memcpy(s, token->start, token->length);
-    s[token->length] = '\0';
-    return s;
 }
 
-ast_node_list_t* create_ast_node_list() {
-    ast_node_list_t* ast_node_list = malloc(sizeof(ast_node_list_t));
-    if (ast_node_list == NULL) {
-        fprintf(stderr, "Could not allocate memory for ast_node_list\n");
-        exit(EXIT_FAILURE);
-    }
-    memset(ast_node_list, 0, sizeof(ast_node_list_t));
-    return ast_node_list;
-}
-
-ast_node_t* create_ast_node(ast_node_type_t type) {
-    ast_node_t* node = malloc(sizeof(ast_node_t));
-    if (node == NULL) {
-        fprintf(stderr, "Could not allocate memory for ast_node\n");
-        exit(EXIT_FAILURE);
-    }
-    memset(node, 0, sizeof(ast_node_t));
+// Nodes come zeroed from the arena and live until it is freed.
+ast_node_t* create_ast_node(arena_t* arena, ast_node_type_t type) {
+    ast_node_t* node = arena_alloc(arena, node_size(type));
     node->type = type;
     return node;
 }
 
-ast_node_t* create_ast_node_root() {
-    ast_node_t* node =  create_ast_node(NODE_ROOT);
-    node->as.root.stmts = create_ast_node_stmtlist();
+ast_node_t* create_ast_node_root(arena_t* arena) {
+    ast_node_t* node =  create_ast_node(arena, NODE_ROOT);
+    node->as.root.stmts = create_ast_node_stmtlist(arena);
     return node;
 }
 
-ast_node_t* create_ast_node_number(token_t* token) {
-    ast_node_t* node =  create_ast_node(NODE_INT);
-    char *str = lexeme(token);
-    node->line = token->line;
-    node->as.number.value = atoi(str);
-    free(str);
+ast_node_t* create_ast_node_number(arena_t* arena, token_t* token) {
+    ast_node_t* node =  create_ast_node(arena, NODE_INT);
+    node->offset = token->offset;
+    node->as.number.value = token->value;
     return node;
 }
 
-ast_node_t* create_ast_node_ident(token_t* token) {
-    ast_node_t* node =  create_ast_node(NODE_IDENT);
-    node->line = token->line;
-    node->as.ident.value = lexeme(token);
+ast_node_t* create_ast_node_ident(arena_t* arena, token_t* token,
+    atom_t* atom) {
+    ast_node_t* node =  create_ast_node(arena, NODE_IDENT);
+    node->offset = token->offset;
+    node->as.ident.atom = atom;
     return node;
 }
 
-ast_node_t* create_ast_node_string(token_t* token) {
-    ast_node_t* node =  create_ast_node(NODE_STRING);
-    node->line = token->line;
-    node->as.string.value = lexeme(token);
+// text is the string decoded by the scanner, see literal_string().
+ast_node_t* create_ast_node_string(arena_t* arena, token_t* token,
+    const char* text, uint32_t length) {
+    ast_node_t* node =  create_ast_node(arena, NODE_STRING);
+    node->offset = token->offset;
+    node->as.string.value = arena_strndup(arena, text, length);
+    node->as.string.length = length;
     return node;
 }
 
-ast_node_t* create_ast_node_char(token_t* token) {
-    ast_node_t* node =  create_ast_node(NODE_CHAR);
-    node->line = token->line;
-    node->as.character.value = lexeme(token);
+ast_node_t* create_ast_node_char(arena_t* arena, token_t* token) {
+    ast_node_t* node =  create_ast_node(arena, NODE_CHAR);
+    node->offset = token->offset;
+    node->as.character.value = (char)token->value;
     return node;
 }
 
-ast_node_t* create_ast_node_funccall(ast_node_t* ident) {
-    ast_node_t* node =  create_ast_node(NODE_FUNCCALL);
-    node->line = ident->line;
+ast_node_t* create_ast_node_funccall(arena_t* arena, ast_node_t* ident) {
+    ast_node_t* node =  create_ast_node(arena, NODE_FUNCCALL);
+    node->offset = ident->offset;
     node->as.funccall.ident = ident;
-    node->as.funccall.params = create_ast_node_param_list();
+    node->as.funccall.params = create_ast_node_param_list(arena);
     return node;
 }
 
-ast_node_t* create_ast_node_funcdecl(decl_type_t type, ast_node_t* ident) {
-    ast_node_t* node =  create_ast_node(NODE_FUNCDECL);
-    node->line = ident->line;
+ast_node_t* create_ast_node_funcdecl(arena_t* arena, decl_type_t type, ast_node_t* ident) {
+    ast_node_t* node =  create_ast_node(arena, NODE_FUNCDECL);
+    node->offset = ident->offset;
     node->as.funcdecl.type = type;
     node->as.funcdecl.ident = ident;
-    node->as.funcdecl.params = create_ast_node_paramdecl_list();
-    node->as.funcdecl.stmts = create_ast_node_stmtlist();
+    node->as.funcdecl.params = create_ast_node_paramdecl_list(arena);
+    node->as.funcdecl.stmts = create_ast_node_stmtlist(arena);
     return node;
 }
 
-ast_node_t* create_ast_node_if(token_t* token, ast_node_t *cond) {
-    ast_node_t* node =  create_ast_node(NODE_IF);
-    node->line = token->line;
+ast_node_t* create_ast_node_if(arena_t* arena, token_t* token, ast_node_t *cond) {
+    ast_node_t* node =  create_ast_node(arena, NODE_IF);
+    node->offset = token->offset;
     node->as.ifstmt.cond = cond;
-    node->as.ifstmt._if = create_ast_node_stmtlist();
-    node->as.ifstmt._else = create_ast_node_stmtlist();
+    node->as.ifstmt._if = create_ast_node_stmtlist(arena);
+    node->as.ifstmt._else = create_ast_node_stmtlist(arena);
     return node;
 }
 
-ast_node_t* create_ast_node_while(token_t* token, ast_node_t *cond) {
-    ast_node_t* node =  create_ast_node(NODE_WHILE);
-    node->line = token->line;
+ast_node_t* create_ast_node_while(arena_t* arena, token_t* token, ast_node_t *cond) {
+    ast_node_t* node =  create_ast_node(arena, NODE_WHILE);
+    node->offset = token->offset;
     node->as.whilestmt.cond = cond;
-    node->as.whilestmt.stmts = create_ast_node_stmtlist();
+    node->as.whilestmt.stmts = create_ast_node_stmtlist(arena);
     return node;
 }
 
-ast_node_t* create_ast_node_for(token_t* token, ast_node_t *init,
+ast_node_t* create_ast_node_for(arena_t* arena, token_t* token, ast_node_t *init,
                                 ast_node_t *cond, ast_node_t *incr) {
-    ast_node_t* node =  create_ast_node(NODE_FOR);
-    node->line = token->line;
+    ast_node_t* node =  create_ast_node(arena, NODE_FOR);
+    node->offset = token->offset;
     node->as.forstmt.init = init;
     node->as.forstmt.cond = cond;
     node->as.forstmt.incr = incr;
-    node->as.forstmt.stmts = create_ast_node_stmtlist();
+    node->as.forstmt.stmts = create_ast_node_stmtlist(arena);
     return node;
 }
 
-ast_node_t* create_ast_node_return(token_t* token, ast_node_t *expr) {
-    ast_node_t* node =  create_ast_node(NODE_RETURN);
-    node->line = token->line;
-    node->line = expr->line;
+ast_node_t* create_ast_node_return(arena_t* arena, token_t* token, ast_node_t *expr) {
+    ast_node_t* node =  create_ast_node(arena, NODE_RETURN);
+    node->offset = token->offset;
+    node->offset = expr->offset;
     node->as._return.expr = expr;
     return node;
 }
 
 
-ast_node_t* create_ast_node_assign(ast_node_t* left, ast_node_t* right) {
-    ast_node_t* node =  create_ast_node(NODE_ASSIGN);
-    node->line = left->line;
+ast_node_t* create_ast_node_assign(arena_t* arena, ast_node_t* left, ast_node_t* right) {
+    ast_node_t* node =  create_ast_node(arena, NODE_ASSIGN);
+    node->offset = left->offset;
     node->as.assign.left = left;
     node->as.assign.right = right;
     return node;
 }
 
-ast_node_t* create_ast_node_arrayaccess(ast_node_t* ident, ast_node_t* expr) {
-    ast_node_t* node = create_ast_node(NODE_ARRAYACCESS);
-    node->line = ident->line;
+ast_node_t* create_ast_node_arrayaccess(arena_t* arena, ast_node_t* ident, ast_node_t* expr) {
+    ast_node_t* node = create_ast_node(arena, NODE_ARRAYACCESS);
+    node->offset = ident->offset;
     node->as.arrayaccess.ident = ident;
     node->as.arrayaccess.expr = expr;
     return node;
 }
 
-ast_node_t* create_ast_node_stmtlist() {
-    ast_node_t* node =  create_ast_node(NODE_STMTSLIST);
-    node->as.stmtslist.list = malloc(sizeof(ast_node_list_t));
-    if (node->as.stmtslist.list == NULL) {
-        fprintf(stderr, "Could not allocate memory for ast_node_list\n");
-        exit(EXIT_FAILURE);
-    }
-    node->as.stmtslist.list->head = NULL;
-    node->as.stmtslist.list->tail = NULL;
+ast_node_t* create_ast_node_stmtlist(arena_t* arena) {
+    ast_node_t* node =  create_ast_node(arena, NODE_STMTSLIST);
     return node;
 }
 
-ast_node_t* create_ast_node_paramdecl_list() {
-    ast_node_t* node =  create_ast_node(NODE_PARAMDECL_LIST);
-    node->as.paramsdecllist.list = malloc(sizeof(ast_node_list_t));
-    if (node->as.paramsdecllist.list == NULL) {
-        fprintf(stderr, "Could not allocate memory for ast_node_list\n");
-        exit(EXIT_FAILURE);
-    }
-    node->as.paramsdecllist.list->head = NULL;
-    node->as.paramsdecllist.list->tail = NULL;
+ast_node_t* create_ast_node_paramdecl_list(arena_t* arena) {
+    ast_node_t* node =  create_ast_node(arena, NODE_PARAMDECL_LIST);
     return node;
 }
 
-ast_node_t* create_ast_node_paramdecl(decl_type_t type, ast_node_t* ident, bool is_array) {
-    ast_node_t* node =  create_ast_node(NODE_PARAMDECL);
-    node->line = ident->line;
+ast_node_t* create_ast_node_paramdecl(arena_t* arena, decl_type_t type, ast_node_t* ident, bool is_array) {
+    ast_node_t* node =  create_ast_node(arena, NODE_PARAMDECL);
+    node->offset = ident->offset;
     node->as.paramdecl.type = type;
     node->as.paramdecl.ident = ident;
     node->as.paramdecl.is_array = is_array;
     return node;
 }
 
-ast_node_t* create_ast_node_vardecl(decl_type_t type, ast_node_t* ident, bool is_array, int size) {
-    ast_node_t* node =  create_ast_node(NODE_VARDECL);
-    node->line = ident->line;
+ast_node_t* create_ast_node_vardecl(arena_t* arena, decl_type_t type, ast_node_t* ident, bool is_array, int size) {
+    ast_node_t* node =  create_ast_node(arena, NODE_VARDECL);
+    node->offset = ident->offset;
     node->as.vardecl.type = type;
     node->as.vardecl.ident = ident;
     node->as.vardecl.is_array = is_array;
@@ -215,81 +208,76 @@ ast_node_t* create_ast_node_vardecl(decl_type_t type, ast_node_t* ident, bool is
 }
 
 
-ast_node_t* create_ast_node_param_list() {
-    ast_node_t* node =  create_ast_node(NODE_PARAM_LIST);
-    node->as.paramslist.list = malloc(sizeof(ast_node_list_t));
-    if (node->as.paramslist.list == NULL) {
-        fprintf(stderr, "Could not allocate memory for ast_node_list\n");
-        exit(EXIT_FAILURE);
-    }
-    node->as.paramslist.list->head = NULL;
-    node->as.paramslist.list->tail = NULL;
+ast_node_t* create_ast_node_param_list(arena_t* arena) {
+    ast_node_t* node =  create_ast_node(arena, NODE_PARAM_LIST);
     return node;
 }
 
 
-ast_node_t* create_ast_node_unary(token_t* token, ast_node_t* expr) {
+ast_node_t* create_ast_node_unary(arena_t* arena, token_t* token, ast_node_t* expr) {
     op_t op = tokentype_to_op(token->type);
-    ast_node_t* node =  create_ast_node(NODE_UNARYOP);
-    node->line = token->line;
+    ast_node_t* node =  create_ast_node(arena, NODE_UNARYOP);
+    node->offset = token->offset;
     node->as.unary.op = op;
     node->as.unary.expr = expr;
     return node;
 }
 
-ast_node_t* create_ast_node_binary(token_t* token, ast_node_t* left, ast_node_t* right) {
+ast_node_t* create_ast_node_binary(arena_t* arena, token_t* token, ast_node_t* left, ast_node_t* right) {
     op_t op = tokentype_to_op(token->type);
-    ast_node_t* node =  create_ast_node(NODE_BINOP);
-    node->line = token->line;
+    ast_node_t* node =  create_ast_node(arena, NODE_BINOP);
+    node->offset = token->offset;
     node->as.binary.op = op;
     node->as.binary.left = left;
     node->as.binary.right = right;
     return node;
 }
 
-void add_param(ast_node_t* parent, ast_node_t* child) {
-    if (parent->as.paramslist.list->head == NULL) {
-        parent->as.paramslist.list->head = child;
-    } else {
-        parent->as.paramslist.list->tail->next = child;
-    }
-    parent->as.paramslist.list->tail = child;
-    if (parent->line == 0) {
-        parent->line = child->line;
+void push_ast_node(ast_node_stack_t* stack, ast_node_t* node) {
+    if (stack->count == stack->capacity) {
+        stack->capacity = stack->capacity < 64 ? 64 : stack->capacity * 2;
+        stack->items = realloc(stack->items,
+            stack->capacity * sizeof(ast_node_t*));
+        if (stack->items == NULL) {
+            fprintf(stderr, "Could not allocate memory for ast_node_stack\n");
+            exit(EXIT_FAILURE);
+        }
     }
+    stack->items[stack->count++] = node;
 }
 
-void add_paramdecl(ast_node_t* parent, ast_node_t* child) {
-    if (parent->as.paramsdecllist.list->head == NULL) {
-        parent->as.paramsdecllist.list->head = child;
-    } else {
-        parent->as.paramsdecllist.list->tail->next = child;
-    }
-    parent->as.paramsdecllist.list->tail = child;
-    if (parent->line == 0) {
-        parent->line = child->line;
-    }
+static ast_node_list_t* node_list(ast_node_t* node) {
+    if (node->type == NODE_PARAM_LIST)
+        return &node->as.paramslist.list;
+    if (node->type == NODE_PARAMDECL_LIST)
+        return &node->as.paramsdecllist.list;
+    return &node->as.stmtslist.list;
 }
 
-void add_stmt(ast_node_t* parent, ast_node_t* child) {
-    if (parent->as.stmtslist.list->head == NULL) {
-        parent->as.stmtslist.list->head = child;
-    } else {
-        if ( parent->as.stmtslist.list->tail != NULL) {
-            parent->as.stmtslist.list->tail->next = child;
-        } else {
-            ast_node_t* stmt = parent->as.stmtslist.list->head;
-            while(stmt->next != NULL) {
-                stmt = stmt->next;
-            }
-            stmt->next = child;
-            parent->as.stmtslist.list->tail = child;
-
-        }
-    }
-    parent->as.stmtslist.list->tail = child;
-    if (parent->line == 0) {
-        parent->line = child->line;
+// Moves the nodes pushed since base into parent's list. A list starts where
+// its first child does. Children that failed to parse are dropped.
+void pop_ast_node_list(arena_t* arena, ast_node_stack_t* stack,
+    uint32_t base, ast_node_t* parent) {
+    ast_node_list_t* list = node_list(parent);
+    uint32_t count = 0;
+    for (uint32_t i = base; i < stack->count; i++) {
+        if (stack->items[i] != NULL)
+            stack->items[base + count++] = stack->items[i];
     }
+    stack->count = base;
+    if (count == 0)
+        return;
+
+    list->items = arena_alloc(arena, count * sizeof(ast_node_t*));
+    memcpy(list->items, &stack->items[base], count * sizeof(ast_node_t*));
+    list->count = count;
+    for (uint32_t i = 0; i < count && parent->offset == 0; i++)
+        parent->offset = list->items[i]->offset;
 }
 
+void free_ast_node_stack(ast_node_stack_t* stack) {
+    free(stack->items);
+    stack->items = NULL;
+    stack->count = 0;
+    stack->capacity = 0;
+}
@@ -4,6 +4,10 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "token.h"
+#include "arena.h"
+#include "intern.h"
+
+struct sym_entry;
 
 typedef enum {
     NODE_ROOT,
@@ -27,10 +31,18 @@ typedef enum {
     TYPE_INT, TYPE_CHAR, TYPE_VOID
 } decl_type_t;
 
+// Children of a list node, contiguous in the arena.
+typedef struct ast_node_list {
+    struct ast_node** items;
+    uint32_t count;
+} ast_node_list_t;
+
+// Only the header and the member of its kind are allocated for a node, see
+// create_ast_node(), so a node must never be read through another member.
 typedef struct ast_node {
     ast_node_type_t type;
-    struct ast_node* next;
-    uint32_t line;
+    // Where the node is in the source, see line_index.h.
+    uint32_t offset;
 
     union {
         struct {
@@ -42,15 +54,20 @@ typedef struct ast_node {
         } number;
 
         struct {
-            char* value;
+            char value;
         } character;
 
+        // Escapes are decoded, value is '\0' terminated.
         struct {
             char* value;
+            uint32_t length;
         } string;
 
         struct {
-            char* value;
+            atom_t* atom;
+            // What the name resolves to where it is, NULL when it does not
+            // resolve while parsing. Set by the parser and the symbol table.
+            struct sym_entry* entry;
         } ident;
 
         struct {
@@ -58,14 +75,17 @@ typedef struct ast_node {
             struct ast_node* ident;
             struct ast_node* params;
             struct ast_node* stmts;
+            // 1 + the index of the body in parser->deferred while it is
+            // not parsed, 0 once it is.
+            uint32_t deferred_body;
         } funcdecl;
 
         struct {
-            struct ast_node_list* list;
+            ast_node_list_t list;
         } paramslist;
 
         struct {
-            struct ast_node_list* list;
+            ast_node_list_t list;
         } paramsdecllist;
 
         struct {
@@ -82,13 +102,15 @@ typedef struct ast_node {
         } vardecl;
 
         struct {
-            struct ast_node_list* list;
+            ast_node_list_t list;
         } stmtslist;
 
         struct {
             //decl_type_t type;
             struct ast_node* ident;
             struct ast_node* params;
+            // The global called, NULL when it is declared after the call.
+            struct sym_entry* entry;
         } funccall;
 
         struct {
@@ -136,37 +158,41 @@ typedef struct ast_node {
     } as;
 } ast_node_t;
 
-typedef struct ast_node_list {
-    struct ast_node* head;
-    struct ast_node* tail;
-} ast_node_list_t ;
+// Children are pushed here while their list is parsed. Lists nest like the
+// grammar, so each one is the run of nodes above where it began.
+typedef struct {
+    ast_node_t** items;
+    uint32_t count;
+    uint32_t capacity;
+} ast_node_stack_t;
 
 decl_type_t tokentype_2_decltype(token_type_t type);
-ast_node_t* create_ast_node(ast_node_type_t type);
-ast_node_list_t* create_ast_node_list();
-void add_stmt(ast_node_t* parent, ast_node_t* stmt);
-void add_param(ast_node_t* parent, ast_node_t* child);
-void add_paramdecl(ast_node_t* parent, ast_node_t* child);
-ast_node_t* create_ast_node_number(token_t* token);
-ast_node_t* create_ast_node_ident(token_t* token);
-ast_node_t* create_ast_node_string(token_t* token);
-ast_node_t* create_ast_node_char(token_t* token);
-ast_node_t* create_ast_node_unary(token_t* token, ast_node_t* expr);
-ast_node_t* create_ast_node_binary(token_t* token, ast_node_t* left, ast_node_t* right);
-ast_node_t* create_ast_node_funccall(ast_node_t* ident);
-ast_node_t* create_ast_node_param_list();
-ast_node_t* create_ast_node_stmtlist();
-ast_node_t* create_ast_node_if(token_t* token, ast_node_t *cond);
-ast_node_t* create_ast_node_while(token_t* token, ast_node_t *cond);
-ast_node_t* create_ast_node_assign(ast_node_t* left, ast_node_t* right);
-ast_node_t* create_ast_node_arrayaccess(ast_node_t* ident, ast_node_t* expr);
-ast_node_t* create_ast_node_root();
-ast_node_t* create_ast_node_return(token_t* token, ast_node_t *expr);
-ast_node_t* create_ast_node_for(token_t* token, ast_node_t *init, ast_node_t *cond, ast_node_t *incr);
-ast_node_t* create_ast_node_paramdecl_list();
-ast_node_t* create_ast_node_paramdecl(decl_type_t type, ast_node_t* ident, bool is_array);
-ast_node_t* create_ast_node_vardecl(decl_type_t type, ast_node_t* ident, bool is_array, int size);
-ast_node_t* create_ast_node_funcdecl(decl_type_t type, ast_node_t* ident);
+ast_node_t* create_ast_node(arena_t* arena, ast_node_type_t type);
+void push_ast_node(ast_node_stack_t* stack, ast_node_t* node);
+void pop_ast_node_list(arena_t* arena, ast_node_stack_t* stack,
+    uint32_t base, ast_node_t* parent);
+void free_ast_node_stack(ast_node_stack_t* stack);
+ast_node_t* create_ast_node_number(arena_t* arena, token_t* token);
+ast_node_t* create_ast_node_ident(arena_t* arena, token_t* token, atom_t* atom);
+ast_node_t* create_ast_node_string(arena_t* arena, token_t* token,
+    const char* text, uint32_t length);
+ast_node_t* create_ast_node_char(arena_t* arena, token_t* token);
+ast_node_t* create_ast_node_unary(arena_t* arena, token_t* token, ast_node_t* expr);
+ast_node_t* create_ast_node_binary(arena_t* arena, token_t* token, ast_node_t* left, ast_node_t* right);
+ast_node_t* create_ast_node_funccall(arena_t* arena, ast_node_t* ident);
+ast_node_t* create_ast_node_param_list(arena_t* arena);
+ast_node_t* create_ast_node_stmtlist(arena_t* arena);
+ast_node_t* create_ast_node_if(arena_t* arena, token_t* token, ast_node_t *cond);
+ast_node_t* create_ast_node_while(arena_t* arena, token_t* token, ast_node_t *cond);
+ast_node_t* create_ast_node_assign(arena_t* arena, ast_node_t* left, ast_node_t* right);
+ast_node_t* create_ast_node_arrayaccess(arena_t* arena, ast_node_t* ident, ast_node_t* expr);
+ast_node_t* create_ast_node_root(arena_t* arena);
+ast_node_t* create_ast_node_return(arena_t* arena, token_t* token, ast_node_t *expr);
+ast_node_t* create_ast_node_for(arena_t* arena, token_t* token, ast_node_t *init, ast_node_t *cond, ast_node_t *incr);
+ast_node_t* create_ast_node_paramdecl_list(arena_t* arena);
+ast_node_t* create_ast_node_paramdecl(arena_t* arena, decl_type_t type, ast_node_t* ident, bool is_array);
+ast_node_t* create_ast_node_vardecl(arena_t* arena, decl_type_t type, ast_node_t* ident, bool is_array, int size);
+ast_node_t* create_ast_node_funcdecl(arena_t* arena, decl_type_t type, ast_node_t* ident);
 
 #endif
 
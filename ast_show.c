@@ -3,6 +3,8 @@
 #include <string.h>
 
 #include "ast_show.h"
+#include "ast_visitor.h"
+#include "line_index.h"
 
 #define LEVEL_STEP 2
 
@@ -32,6 +34,27 @@ static char* node_type_to_str(ast_node_type_t type) {
     }
 }
 
+// Writes c as it would be spelled in a literal delimited by quote and
+// returns the end of what was written.
+static char* escape(char* dest, char c, char quote) {
+    char escaped;
+    switch (c) {
+        case '\n':  escaped = 'n'; break;
+        case '\t':  escaped = 't'; break;
+        case '\0':  escaped = '0'; break;
+        case '\\': escaped = '\\'; break;
+        default:
+            if (c != quote) {
+                *dest++ = c;
+                return dest;
+            }
+            escaped = c;
+    }
+    *dest++ = '\\';
+    *dest++ = escaped;
+    return dest;
+}
+
 static char* decltype_to_str(decl_type_t type) {
     switch (type) {
         case TYPE_INT: return "int";
@@ -60,148 +83,127 @@ static char* op_to_str(op_t op) {
     }
 }
 
-void print_with_indent(int line, char* str, int level) {
-    printf("Line: %d -> %*s%s\n", line, level, "", str);
+typedef struct {
+    FILE* out;
+    line_index_t* line_index;
+    // Nodes are printed mostly in source order, so the line is looked up
+    // from the previous one.
+    uint32_t line_hint;
+} ast_show_t;
+
+static void print_with_indent(ast_show_t* show, uint32_t offset, char* str,
+    int level) {
+    fprintf(show->out, "Line: %u -> %*s%s\n",
+        line_of_offset_near(show->line_index, offset, &show->line_hint),
+        level, "", str);
 }
 
-static void do_show_ast(char *field, ast_node_t* node, int level) {
+// Prints one node, the walk reaches its children after it.
+static bool show_node(const ast_visit_t* visit, void* data) {
+    ast_show_t* show = data;
+    ast_node_t* node = visit->node;
+    const char* field = visit->field;
+    int level = (int)visit->depth * LEVEL_STEP;
     char str[1024];
 
-    if (node == NULL) return;
-
     if (node->type == NODE_ROOT) {
         //printf("root:\n");
-        do_show_ast("stmts", node->as.root.stmts, level + LEVEL_STEP);
     }
     else if (node->type == NODE_BINOP) {
         sprintf(str, "%s: %s op: %s",
             field, node_type_to_str(node->type), op_to_str(node->as.binary.op));
-
-        print_with_indent(node->line, str, level);
-
-        do_show_ast("left", node->as.binary.left, level + LEVEL_STEP);
-        do_show_ast("right", node->as.binary.right, level + LEVEL_STEP);
+        print_with_indent(show, node->offset, str, level);
     }
     else if (node->type == NODE_UNARYOP) {
         sprintf(str, "%s: %s op: %s",
             field, node_type_to_str(node->type), op_to_str(node->as.unary.op));
-        print_with_indent(node->line, str, level);
-        do_show_ast("expr", node->as.unary.expr, level + LEVEL_STEP);
+        print_with_indent(show, node->offset, str, level);
     }
     else if (node->type == NODE_INT) {
         sprintf(str, "%s: %s value: %d",
             field, node_type_to_str(node->type), node->as.number.value);
-        print_with_indent(node->line, str, level);
+        print_with_indent(show, node->offset, str, level);
     }
     else if (node->type == NODE_CHAR) {
+        char value[3];
+        *escape(value, node->as.character.value, '\'') = '\0';
         sprintf(str, "%s: %s value: '%s'",
-            field, node_type_to_str(node->type), node->as.character.value);
-        print_with_indent(node->line, str, level);
+            field, node_type_to_str(node->type), value);
+        print_with_indent(show, node->offset, str, level);
     }
     else if (node->type == NODE_IDENT) {
-        size_t size = strlen(node->as.string.value) + 64;
+        size_t size = node->as.ident.atom->length + 64;
         char* dynamic_str = malloc(size * sizeof(char));
         if (dynamic_str == NULL) {
             fprintf(stderr, "Could not allocate memory for NODE_IDENT\n");
             exit(EXIT_FAILURE);
         }
         sprintf(dynamic_str, "%s: %s value: '%s'",
-            field, node_type_to_str(node->type), node->as.ident.value);
-        print_with_indent(node->line, dynamic_str, level);
+            field, node_type_to_str(node->type), node->as.ident.atom->name);
+        print_with_indent(show, node->offset, dynamic_str, level);
         free(dynamic_str);
     }
     else if (node->type == NODE_STRING) {
-        size_t size = strlen(node->as.string.value) + 64;
+        size_t size = 2 * (size_t)node->as.string.length + 64;
         char* dynamic_str = malloc(size * sizeof(char));
         if (dynamic_str == NULL) {
             fprintf(stderr, "Could not allocate memory for NODE_STRING\n");
             exit(EXIT_FAILURE);
         }
-        sprintf(dynamic_str, "%s: %s value: \"%s\"",
-            field, node_type_to_str(node->type), node->as.string.value);
-        print_with_indent(node->line, dynamic_str, level);
+        char* end = dynamic_str + sprintf(dynamic_str, "%s: %s value: \"",
+            field, node_type_to_str(node->type));
+        for (uint32_t i = 0; i < node->as.string.length; i++)
+            end = escape(end, node->as.string.value[i], '"');
+        strcpy(end, "\"");
+        print_with_indent(show, node->offset, dynamic_str, level);
         free(dynamic_str);
     }
     else if (node->type == NODE_FUNCCALL) {
         sprintf(str, "%s: %s", field, node_type_to_str(node->type));
-        print_with_indent(node->line, str, level);
-        do_show_ast("ident", node->as.funccall.ident, level + LEVEL_STEP);
-        do_show_ast("params", node->as.funccall.params, level + LEVEL_STEP);
+        print_with_indent(show, node->offset, str, level);
     }
     else if (node->type == NODE_PARAM_LIST) {
         sprintf(str, "%s: %s", field, node_type_to_str(node->type));
-        print_with_indent(node->line, str, level);
-        ast_node_t* param = node->as.paramslist.list->head;
-        while (param) {
-            do_show_ast("param", param, level + LEVEL_STEP);
-            param = param->next;
-        }
+        print_with_indent(show, node->offset, str, level);
     }
     else if (node->type == NODE_PARAMDECL_LIST) {
-        if (node->as.paramsdecllist.list->head == NULL) return;
+        if (node->as.paramsdecllist.list.count == 0) return true;
         sprintf(str, "%s: %s", field, node_type_to_str(node->type));
-        print_with_indent(node->line, str, level);
-        ast_node_t* param = node->as.paramsdecllist.list->head;
-        while (param) {
-            do_show_ast("param", param, level + LEVEL_STEP);
-            param = param->next;
-        }
+        print_with_indent(show, node->offset, str, level);
     }
     else if (node->type == NODE_IF) {
         sprintf(str, "%s: %s", field, node_type_to_str(node->type));
-        print_with_indent(node->line, str, level);
-        do_show_ast("cond", node->as.ifstmt.cond, level + LEVEL_STEP);
-        do_show_ast("_if", node->as.ifstmt._if, level + LEVEL_STEP);
-        do_show_ast("_else", node->as.ifstmt._else, level + LEVEL_STEP);
+        print_with_indent(show, node->offset, str, level);
     }
     else if (node->type == NODE_WHILE) {
         sprintf(str, "%s: %s", field, node_type_to_str(node->type));
-        print_with_indent(node->line, str, level);
-        do_show_ast("cond", node->as.whilestmt.cond, level + LEVEL_STEP);
-        do_show_ast("stmts", node->as.whilestmt.stmts, level + LEVEL_STEP);
+        print_with_indent(show, node->offset, str, level);
     }
     else if (node->type == NODE_FOR) {
         sprintf(str, "%s: %s", field, node_type_to_str(node->type));
-        print_with_indent(node->line, str, level);
-        do_show_ast("init", node->as.forstmt.init, level + LEVEL_STEP);
-        do_show_ast("cond", node->as.forstmt.cond, level + LEVEL_STEP);
-        do_show_ast("incr", node->as.forstmt.incr, level + LEVEL_STEP);
-        do_show_ast("stmts", node->as.forstmt.stmts, level + LEVEL_STEP);
+        print_with_indent(show, node->offset, str, level);
     }
     else if (node->type == NODE_FUNCDECL) {
         sprintf(str, "%s: %s type: %s", field, node_type_to_str(node->type),
             decltype_to_str(node->as.funcdecl.type));
-        print_with_indent(node->line, str, level);
-        do_show_ast("ident", node->as.funcdecl.ident, level + LEVEL_STEP);
-        do_show_ast("params", node->as.funcdecl.params, level + LEVEL_STEP);
-        do_show_ast("stmts", node->as.funcdecl.stmts, level + LEVEL_STEP);
+        print_with_indent(show, node->offset, str, level);
     }
     else if (node->type == NODE_RETURN) {
         sprintf(str, "%s: %s", field, node_type_to_str(node->type));
-        print_with_indent(node->line, str, level);
-        do_show_ast("expr", node->as._return.expr, level + LEVEL_STEP);
+        print_with_indent(show, node->offset, str, level);
     }
     else if (node->type == NODE_STMTSLIST) {
-        if (node->as.stmtslist.list->head == NULL) return;
+        if (node->as.stmtslist.list.count == 0) return true;
         sprintf(str, "%s: %s", field, node_type_to_str(node->type));
-        print_with_indent(node->line, str, level);
-        ast_node_t* stmt = node->as.stmtslist.list->head;
-        while (stmt) {
-            do_show_ast("stmt", stmt, level + LEVEL_STEP);
-            stmt = stmt->next;
-        }
+        print_with_indent(show, node->offset, str, level);
     }
     else if (node->type == NODE_ASSIGN) {
         sprintf(str, "%s: %s", field, node_type_to_str(node->type));
-        print_with_indent(node->line, str, level);
-        do_show_ast("left", node->as.assign.left, level + LEVEL_STEP);
-        do_show_ast("right", node->as.assign.right, level + LEVEL_STEP);
+        print_with_indent(show, node->offset, str, level);
     }
     else if (node->type == NODE_ARRAYACCESS) {
         sprintf(str, "%s: %s", field, node_type_to_str(node->type));
-        print_with_indent(node->line, str, level);
-        do_show_ast("ident", node->as.arrayaccess.ident, level + LEVEL_STEP);
-        do_show_ast("expr", node->as.arrayaccess.expr, level + LEVEL_STEP);
+        print_with_indent(show, node->offset, str, level);
     }
     else if (node->type == NODE_PARAMDECL) {
         sprintf(str, "%s: %s type: %s %s",
@@ -210,8 +212,7 @@ static void do_show_ast(char *field, ast_node_t* node, int level) {
             decltype_to_str(node->as.paramdecl.type),
             node->as.paramdecl.is_array ? "[]":""
         );
-        print_with_indent(node->line, str, level);
-        do_show_ast("ident", node->as.paramdecl.ident, level + LEVEL_STEP);
+        print_with_indent(show, node->offset, str, level);
     }
     else if (node->type == NODE_VARDECL) {
         char s[16];
@@ -223,14 +224,16 @@ static void do_show_ast(char *field, ast_node_t* node, int level) {
             decltype_to_str(node->as.vardecl.type),
             node->as.vardecl.is_array ? s : ""
         );
-        print_with_indent(node->line, str, level);
-        do_show_ast("ident", node->as.vardecl.ident, level + LEVEL_STEP);
+        print_with_indent(show, node->offset, str, level);
     }
+    return true;
 }
 
-void show_ast(ast_node_t *node) {
-    puts("========================== Abstract Syntax Tree (AST) ==========================");
-    do_show_ast("", node, 0);
-    puts("================================================================================\n");
+
+void show_ast(FILE* out, line_index_t* line_index, ast_node_t *node) {
+    ast_show_t show = { out, line_index, 1 };
+    fputs("========================== Abstract Syntax Tree (AST) ==========================\n", out);
+    walk_ast(node, show_node, NULL, &show);
+    fputs("================================================================================\n\n", out);
 }
 
@@ -1,8 +1,10 @@
 #ifndef cmm_ast_show_h
 #define cmm_ast_show_h
 
+#include <stdio.h>
 #include "ast.h"
+#include "line_index.h"
 
-void show_ast(ast_node_t *node);
+void show_ast(FILE* out, line_index_t* line_index, ast_node_t *node);
 
 #endif
\ No newline at end of file
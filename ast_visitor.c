@@ -1,98 +1,211 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 
 #include "ast_visitor.h"
 
+// Frames that fit on the C stack before the walk moves to the heap.
+#define WALK_INITIAL_FRAMES 64
 
-static void do_visit_ast(ast_node_t* node, void (*callback)(ast_node_t*)) {
+// A child pointer of a node and the name it is shown with.
+typedef struct {
+    const char* field;
+    size_t offset;
+} ast_slot_t;
 
-    if (node == NULL) return;
+// Where the children of each node type are. List nodes have items named
+// item, every other node has count fixed slots, which may hold NULL.
+typedef struct {
+    const ast_slot_t* slots;
+    uint32_t count;
+    const char* item;
+    size_t list;
+} ast_shape_t;
 
-    callback(node);
+#define SLOT(name, member) { name, offsetof(ast_node_t, as.member) }
+#define FIXED(slots) { slots, sizeof(slots) / sizeof(slots[0]), NULL, 0 }
+#define LIST(name, member) { NULL, 0, name, offsetof(ast_node_t, as.member) }
 
-    if (node->type == NODE_ROOT) {
-        do_visit_ast(node->as.root.stmts, callback);
-    }
-    else if (node->type == NODE_BINOP) {
-        do_visit_ast(node->as.binary.left, callback);
-        do_visit_ast(node->as.binary.right, callback);
-    }
-    else if (node->type == NODE_UNARYOP) {
-        do_visit_ast(node->as.unary.expr, callback);
-    }
-    else if (node->type == NODE_INT) {
-    }
-    else if (node->type == NODE_CHAR) {
-    }
-    else if (node->type == NODE_IDENT) {
-    }
-    else if (node->type == NODE_STRING) {
-    }
-    else if (node->type == NODE_FUNCCALL) {
-        do_visit_ast(node->as.funccall.ident, callback);
-        do_visit_ast(node->as.funccall.params, callback);
-    }
-    else if (node->type == NODE_PARAM_LIST) {
-        ast_node_t* param = node->as.paramslist.list->head;
-        while (param) {
-            do_visit_ast(param, callback);
-            param = param->next;
+static const ast_slot_t root_slots[] = { SLOT("stmts", root.stmts) };
+static const ast_slot_t binary_slots[] = {
+    SLOT("left", binary.left), SLOT("right", binary.right)
+};
+static const ast_slot_t unary_slots[] = { SLOT("expr", unary.expr) };
+static const ast_slot_t funccall_slots[] = {
+    SLOT("ident", funccall.ident), SLOT("params", funccall.params)
+};
+static const ast_slot_t if_slots[] = {
+    SLOT("cond", ifstmt.cond), SLOT("_if", ifstmt._if),
+    SLOT("_else", ifstmt._else)
+};
+static const ast_slot_t while_slots[] = {
+    SLOT("cond", whilestmt.cond), SLOT("stmts", whilestmt.stmts)
+};
+static const ast_slot_t for_slots[] = {
+    SLOT("init", forstmt.init), SLOT("cond", forstmt.cond),
+    SLOT("incr", forstmt.incr), SLOT("stmts", forstmt.stmts)
+};
+static const ast_slot_t funcdecl_slots[] = {
+    SLOT("ident", funcdecl.ident), SLOT("params", funcdecl.params),
+    SLOT("stmts", funcdecl.stmts)
+};
+static const ast_slot_t return_slots[] = { SLOT("expr", _return.expr) };
+static const ast_slot_t assign_slots[] = {
+    SLOT("left", assign.left), SLOT("right", assign.right)
+};
+static const ast_slot_t arrayaccess_slots[] = {
+    SLOT("ident", arrayaccess.ident), SLOT("expr", arrayaccess.expr)
+};
+static const ast_slot_t paramdecl_slots[] = { SLOT("ident", paramdecl.ident) };
+static const ast_slot_t vardecl_slots[] = { SLOT("ident", vardecl.ident) };
+
+// Leaves and unused types have no children.
+static const ast_shape_t shapes[] = {
+    [NODE_ROOT] = FIXED(root_slots),
+    [NODE_BINOP] = FIXED(binary_slots),
+    [NODE_UNARYOP] = FIXED(unary_slots),
+    [NODE_FUNCCALL] = FIXED(funccall_slots),
+    [NODE_PARAM_LIST] = LIST("param", paramslist.list),
+    [NODE_PARAMDECL_LIST] = LIST("param", paramsdecllist.list),
+    [NODE_IF] = FIXED(if_slots),
+    [NODE_WHILE] = FIXED(while_slots),
+    [NODE_FOR] = FIXED(for_slots),
+    [NODE_FUNCDECL] = FIXED(funcdecl_slots),
+    [NODE_RETURN] = FIXED(return_slots),
+    [NODE_STMTSLIST] = LIST("stmt", stmtslist.list),
+    [NODE_ASSIGN] = FIXED(assign_slots),
+    [NODE_ARRAYACCESS] = FIXED(arrayaccess_slots),
+    [NODE_PARAMDECL] = FIXED(paramdecl_slots),
+    [NODE_VARDECL] = FIXED(vardecl_slots),
+    [NODE_VARDECL_LIST] = { NULL, 0, NULL, 0 },
+};
+
+// A node being walked and the index of the next child to look at.
+typedef struct {
+    ast_visit_t visit;
+    uint32_t next;
+} ast_frame_t;
+
+// Set as the next child of a node whose children are skipped.
+#define CHILDREN_SKIPPED UINT32_MAX
+
+// Finds the first child of node at or after *index that is not NULL,
+// leaving *index just past it. Returns false when there is none.
+static bool next_child(ast_node_t* node, uint32_t* index, ast_node_t** child,
+    const char** field) {
+    const ast_shape_t* shape = &shapes[node->type];
+    if (shape->item != NULL) {
+        ast_node_list_t* list =
+            (ast_node_list_t*)((char*)node + shape->list);
+        if (*index >= list->count) return false;
+        *child = list->items[(*index)++];
+        *field = shape->item;
+        return true;
+    }
+    while (*index < shape->count) {
+        const ast_slot_t* slot = &shape->slots[(*index)++];
+        *child = *(ast_node_t**)((char*)node + slot->offset);
+        if (*child != NULL) {
+            *field = slot->field;
+            return true;
         }
     }
-    else if (node->type == NODE_PARAMDECL_LIST) {
-        ast_node_t* param = node->as.paramsdecllist.list->head;
-        while (param) {
-            do_visit_ast(param, callback);
-            param = param->next;
+    return false;
+}
+
+void walk_ast(ast_node_t* node, ast_pre_fn pre, ast_post_fn post,
+    void* data) {
+    ast_frame_t initial[WALK_INITIAL_FRAMES];
+    ast_frame_t* frames = initial;
+    uint32_t capacity = WALK_INITIAL_FRAMES;
+    uint32_t count = 0;
+
+    const char* field = "";
+    while (node != NULL || count > 0) {
+        if (node != NULL) {
+            if (count == capacity) {
+                capacity *= 2;
+                ast_frame_t* grown = realloc(frames == initial ? NULL : frames,
+                    capacity * sizeof(ast_frame_t));
+                if (grown == NULL) {
+                    fprintf(stderr, "Could not allocate memory for the AST walk\n");
+                    exit(EXIT_FAILURE);
+                }
+                if (frames == initial)
+                    memcpy(grown, initial, sizeof(initial));
+                frames = grown;
+            }
+            ast_frame_t* frame = &frames[count++];
+            frame->visit.node = node;
+            frame->visit.field = field;
+            frame->visit.depth = count - 1;
+            frame->next = 0;
+            if (pre != NULL && !pre(&frame->visit, data))
+                frame->next = CHILDREN_SKIPPED;
+            node = NULL;
         }
-    }
-    else if (node->type == NODE_IF) {
-        do_visit_ast(node->as.ifstmt.cond, callback);
-        do_visit_ast(node->as.ifstmt._if, callback);
-        do_visit_ast(node->as.ifstmt._else, callback);
-    }
-    else if (node->type == NODE_WHILE) {
-        do_visit_ast(node->as.whilestmt.cond, callback);
-        do_visit_ast(node->as.whilestmt.stmts, callback);
-    }
-    else if (node->type == NODE_FOR) {
-        do_visit_ast(node->as.forstmt.init, callback);
-        do_visit_ast(node->as.forstmt.cond, callback);
-        do_visit_ast(node->as.forstmt.incr, callback);
-        do_visit_ast(node->as.forstmt.stmts, callback);
-    }
-    else if (node->type == NODE_FUNCDECL) {
-        do_visit_ast(node->as.funcdecl.ident, callback);
-        do_visit_ast(node->as.funcdecl.params, callback);
-        do_visit_ast(node->as.funcdecl.stmts, callback);
-    }
-    else if (node->type == NODE_RETURN) {
-        do_visit_ast(node->as._return.expr, callback);
-    }
-    else if (node->type == NODE_STMTSLIST) {
-        ast_node_t* stmt = node->as.stmtslist.list->head;
-        while (stmt) {
-            do_visit_ast(stmt, callback);
-            stmt = stmt->next;
+
+        ast_frame_t* top = &frames[count - 1];
+        if (top->next == CHILDREN_SKIPPED ||
+            !next_child(top->visit.node, &top->next, &node, &field)) {
+            if (post != NULL) post(&top->visit, data);
+            count--;
+            node = NULL;
         }
     }
-    else if (node->type == NODE_ASSIGN) {
-        do_visit_ast(node->as.assign.left, callback);
-        do_visit_ast(node->as.assign.right, callback);
-    }
-    else if (node->type == NODE_ARRAYACCESS) {
-        do_visit_ast(node->as.arrayaccess.ident, callback);
-        do_visit_ast(node->as.arrayaccess.expr, callback);
-    }
-    else if (node->type == NODE_PARAMDECL) {
-        do_visit_ast(node->as.paramdecl.ident, callback);
-    }
-    else if (node->type == NODE_VARDECL) {
-        do_visit_ast(node->as.vardecl.ident, callback);
+
+    if (frames != initial) free(frames);
+}
+
+// Set in skip_depth while a pass walks every node.
+#define NOT_SKIPPING UINT32_MAX
+
+// The passes of walk_passes() and, for each, the depth of the node whose
+// children it skips.
+typedef struct {
+    const ast_pass_t* passes;
+    uint32_t count;
+    uint32_t skip_depth[AST_MAX_PASSES];
+} ast_fused_t;
+
+static bool enter_passes(const ast_visit_t* visit, void* data) {
+    ast_fused_t* fused = data;
+    ast_node_set_t bit = NODE_BIT(visit->node->type);
+    bool descend = false;
+    for (uint32_t i = 0; i < fused->count; i++) {
+        // Only the children of the skipped node are walked while skipping.
+        if (fused->skip_depth[i] != NOT_SKIPPING) continue;
+        const ast_pass_t* pass = &fused->passes[i];
+        if ((pass->kinds & bit) && pass->enter != NULL &&
+            !pass->enter(visit, pass->data)) {
+            fused->skip_depth[i] = visit->depth;
+        } else {
+            descend = true;
+        }
     }
+    return descend;
 }
 
-void visit_ast(ast_node_t* node, void (*callback)(ast_node_t*)) {
-    do_visit_ast(node, callback);
+static void leave_passes(const ast_visit_t* visit, void* data) {
+    ast_fused_t* fused = data;
+    ast_node_set_t bit = NODE_BIT(visit->node->type);
+    for (uint32_t i = fused->count; i-- > 0;) {
+        if (fused->skip_depth[i] < visit->depth) continue;
+        const ast_pass_t* pass = &fused->passes[i];
+        if ((pass->kinds & bit) && pass->leave != NULL)
+            pass->leave(visit, pass->data);
+        fused->skip_depth[i] = NOT_SKIPPING;
+    }
 }
 
+void walk_passes(ast_node_t* node, const ast_pass_t* passes, uint32_t count) {
+    if (count > AST_MAX_PASSES) {
+        fprintf(stderr, "Too many passes for one AST walk\n");
+        exit(EXIT_FAILURE);
+    }
+    ast_fused_t fused = { passes, count, { 0 } };
+    for (uint32_t i = 0; i < count; i++)
+        fused.skip_depth[i] = NOT_SKIPPING;
+    walk_ast(node, enter_passes, leave_passes, &fused);
+}
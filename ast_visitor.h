@@ -3,6 +3,47 @@
 
 #include "ast.h"
 
-void visit_ast(ast_node_t* node, void (*callback)(ast_node_t*));
+// A node as the walk reaches it. field is the name of the member of the
+// parent holding it, "" for the node the walk started from, and depth is
+// how far below that node it is.
+typedef struct {
+    ast_node_t* node;
+    const char* field;
+    uint32_t depth;
+} ast_visit_t;
 
-#endif
\ No newline at end of file
+// Called before the children of a node, returning false skips them.
+typedef bool (*ast_pre_fn)(const ast_visit_t* visit, void* data);
+// Called after the children of a node, also when they were skipped.
+typedef void (*ast_post_fn)(const ast_visit_t* visit, void* data);
+
+// Walks the tree below node in source order with an explicit stack, so
+// deep trees such as long left-deep expressions cannot overflow the C
+// stack. Either callback may be NULL.
+void walk_ast(ast_node_t* node, ast_pre_fn pre, ast_post_fn post,
+    void* data);
+
+// A set of node types.
+typedef uint32_t ast_node_set_t;
+_Static_assert(NODE_VARDECL_LIST < 32, "node types must fit in an ast_node_set_t");
+#define NODE_BIT(type) ((ast_node_set_t)1 << (type))
+#define ALL_NODES (~(ast_node_set_t)0)
+
+// Passes a single walk_passes() can run.
+#define AST_MAX_PASSES 16
+
+// One analysis over the tree with its own data. enter and leave only see
+// nodes whose type is in kinds. enter returning false skips the children
+// for this pass alone, the others still walk them.
+typedef struct {
+    ast_node_set_t kinds;
+    ast_pre_fn enter;
+    ast_post_fn leave;
+    void* data;
+} ast_pass_t;
+
+// Runs count passes in one walk of the tree below node. At each node they
+// are entered in order and left in reverse order.
+void walk_passes(ast_node_t* node, const ast_pass_t* passes, uint32_t count);
+
+#endif
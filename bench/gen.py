@@ -0,0 +1,48 @@
+#!/usr/bin/env python3
+"""Generates C-- sources for bench/run.sh.
+
+    gen.py blanks N   N functions with deep indentation, long // comment
+                      blocks and long identifiers, where the vector scanner
+                      paths do most of the work
+    gen.py dense N    N functions of short tokens and single blanks
+    gen.py chain N    one function returning an N-term a + a + ... chain,
+                      a left-deep tree of N - 1 binops
+"""
+import sys
+
+
+def blanks(n):
+    out = ["int globalCounterSharedByEveryFunction;\n"]
+    pad = " " * 24
+    for i in range(n):
+        name = f"accumulateTheRunningTotalOfFunction{i}"
+        out.append(f"int {name}(int firstOperandValue, int secondOperandValue)\n{{\n")
+        out.append(f"{pad}// {'-' * 70}\n" * 4)
+        out.append(f"{pad}int intermediateResultForThisStep;\n")
+        out.append(f"{pad}intermediateResultForThisStep = firstOperandValue + secondOperandValue;\n")
+        out.append(f"{pad}// {'the value is kept for the next call ' * 2}\n")
+        out.append(f"{pad}globalCounterSharedByEveryFunction = intermediateResultForThisStep;\n")
+        out.append(f"{pad}return intermediateResultForThisStep;\n}}\n\n")
+    return out
+
+
+def dense(n):
+    out = ["int g[100];\n"]
+    for i in range(n):
+        out.append(f"int f{i}(int a, int b) {{\n int x;\n int y;\n"
+                   f" x = a + b * {i};\n if (x > 3) y = x - 1; else y = 2;\n"
+                   f" while (x < 10) x = x + 1;\n"
+                   f" for (y = 0; y < 3; y = y + 1) g[y] = x - y;\n"
+                   f" return x + y;\n}}\n")
+    return out
+
+
+def chain(n):
+    return ["int main(void)\n{\n  int a;\n  a = 1;\n  return a",
+            " + a" * (n - 1), ";\n}\n"]
+
+
+if __name__ == "__main__":
+    kind, n = sys.argv[1], int(sys.argv[2])
+    sys.stdout.write("".join({"blanks": blanks, "dense": dense,
+                              "chain": chain}[kind](n)))
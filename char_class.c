@@ -0,0 +1,27 @@
+#include <stdint.h>
+#include "char_class.h"
+
+const uint8_t char_class[256] = {
+    ['\0'] = CHAR_END,
+
+    [' '] = CHAR_BLANK, ['\t'] = CHAR_BLANK, ['\r'] = CHAR_BLANK,
+    ['\n'] = CHAR_NEWLINE,
+    ['/'] = CHAR_SLASH,
+
+    ['('] = CHAR_SINGLE, [')'] = CHAR_SINGLE,
+    ['{'] = CHAR_SINGLE, ['}'] = CHAR_SINGLE,
+    ['['] = CHAR_SINGLE, [']'] = CHAR_SINGLE,
+    [';'] = CHAR_SINGLE, [','] = CHAR_SINGLE,
+    ['-'] = CHAR_SINGLE, ['+'] = CHAR_SINGLE, ['*'] = CHAR_SINGLE,
+
+    ['!'] = CHAR_EQUAL_SUFFIX, ['='] = CHAR_EQUAL_SUFFIX,
+    ['<'] = CHAR_EQUAL_SUFFIX, ['>'] = CHAR_EQUAL_SUFFIX,
+
+    ['&'] = CHAR_DOUBLE, ['|'] = CHAR_DOUBLE,
+
+    ['\''] = CHAR_QUOTE, ['"'] = CHAR_DOUBLE_QUOTE,
+
+    ['0' ... '9'] = CHAR_DIGIT,
+    ['a' ... 'z'] = CHAR_ALPHA,
+    ['A' ... 'Z'] = CHAR_ALPHA,
+};
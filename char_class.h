@@ -0,0 +1,27 @@
+#ifndef cmm_char_class_h
+#define cmm_char_class_h
+
+#include <stdint.h>
+
+// Class of every byte, used by the scanner to dispatch on the first byte of a
+// token with a single table load. Bytes that start no token are CHAR_INVALID.
+typedef enum {
+    CHAR_INVALID,
+    CHAR_ALPHA, CHAR_DIGIT,
+    CHAR_BLANK, CHAR_NEWLINE,
+    CHAR_SLASH,
+    CHAR_SINGLE,        // Always a one character token.
+    CHAR_EQUAL_SUFFIX,  // One character token, or two when followed by '='.
+    CHAR_DOUBLE,        // Only valid when doubled: && and ||.
+    CHAR_QUOTE, CHAR_DOUBLE_QUOTE,
+    CHAR_END,
+} char_class_t;
+
+extern const uint8_t char_class[256];
+
+#define CHAR_CLASS(c) ((char_class_t)char_class[(uint8_t)(c)])
+#define IS_ALNUM(c) (CHAR_CLASS(c) == CHAR_ALPHA || CHAR_CLASS(c) == CHAR_DIGIT)
+#define IS_DIGIT(c) (CHAR_CLASS(c) == CHAR_DIGIT)
+#define IS_BLANK(c) (CHAR_CLASS(c) == CHAR_BLANK)
+
+#endif
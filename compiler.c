@@ -1,7 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "compiler.h"
 #include "scanner.h"
+#include "scanner_simd.h"
 #include "parser.h"
 #include "token.h"
 #include "ast.h"
@@ -9,84 +18,477 @@
 #include "opt_parser.h"
 #include "ast_visitor.h"
 #include "analyzer.h"
+#include "line_index.h"
+#include "compiler_ctx.h"
+#include "server.h"
 
+#define READ_CHUNK_SIZE (64 * 1024)
 
-static size_t get_file_size(FILE* fp) {
-    fseek(fp, 0L, SEEK_END);
-    size_t size = ftell(fp);
-    rewind(fp);
-    return size;
+typedef struct {
+    char* buffer;
+    size_t size;
+    // Length of the mapping, 0 when the buffer was read into the heap.
+    size_t mapped_size;
+} source_t;
+
+// What one file of a batch printed, replayed once every file before it was.
+typedef struct {
+    char* out;
+    size_t out_size;
+    char* err;
+    size_t err_size;
+    size_t bytes;
+    bool ok;
+} file_result_t;
+
+typedef struct {
+    opts_t* opts;
+    file_result_t* results;
+    atomic_uint next_file;
+} batch_job_t;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Reads everything left in fp, for pipes and anything else that cannot be
+// mapped. Returns NULL when fp could not be read.
+static char* read_stream(FILE* fp, size_t* size) {
+    size_t capacity = READ_CHUNK_SIZE;
+    size_t bytes_read = 0;
+    char* buffer = NULL;
+
+    for (;;) {
+        // The scanner's vector loads need an aligned and padded buffer,
+        // which realloc() does not keep.
+        char* grown = alloc_source_buffer(capacity);
+        if (grown == NULL) {
+            fprintf(stderr, "Not enough memory to read a source file.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (buffer != NULL)
+            memcpy(grown, buffer, bytes_read);
+        free(buffer);
+        buffer = grown;
+        bytes_read += fread(buffer + bytes_read, sizeof(char),
+            capacity - bytes_read, fp);
+        if (bytes_read < capacity)
+            break;
+        capacity *= 2;
+    }
+
+    if (ferror(fp)) {
+        free(buffer);
+        return NULL;
+    }
+
+    buffer[bytes_read] = '\0';
+    *size = bytes_read;
+    return buffer;
+}
+
+// Maps the file read-only followed by zeroed memory, so the scanner finds its
+// '\0' terminator right after the last byte without copying the file. The
+// kernel zero fills the rest of the last page of the file, and when the file
+// ends on a page boundary the page reserved after it is zero.
+static bool map_file(int fd, size_t file_size, source_t* source) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t mapped_size = (file_size / page_size + 1) * page_size;
+
+    char* reserved = mmap(NULL, mapped_size, PROT_READ,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserved == MAP_FAILED)
+        return false;
+
+    char* buffer = mmap(reserved, file_size, PROT_READ,
+        MAP_PRIVATE | MAP_FIXED, fd, 0);
+    if (buffer == MAP_FAILED) {
+        munmap(reserved, mapped_size);
+        return false;
+    }
+    madvise(buffer, file_size, MADV_SEQUENTIAL);
+
+    source->buffer = buffer;
+    source->size = file_size;
+    source->mapped_size = mapped_size;
+    return true;
 }
 
-static char* read_file(const char* path) {
+static bool read_file(compiler_ctx_t* ctx, const char* path,
+    source_t* source) {
     FILE* fp = fopen(path, "rb");
     if (fp == NULL) {
-        fprintf(stderr, "Could not open file \"%s\".\n", path);
-        exit(EXIT_FAILURE);
+        fprintf(ctx->err, "Could not open file \"%s\".\n", path);
+        return false;
     }
-    size_t file_size = get_file_size(fp);
 
-    char* buffer = (char *)malloc(file_size + 1);
-    if (buffer == NULL) {
-        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-        exit(EXIT_FAILURE);
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        if (map_file(fileno(fp), (size_t)st.st_size, source)) {
+            fclose(fp);
+            return true;
+        }
     }
 
-    size_t bytes_read = fread(buffer, sizeof(char), file_size, fp);
-    if (bytes_read < file_size) {
-        fprintf(stderr, "Could not read file \"%s\".\n", path);
-        exit(EXIT_FAILURE);
+    source->buffer = read_stream(fp, &source->size);
+    source->mapped_size = 0;
+    fclose(fp);
+    if (source->buffer == NULL) {
+        fprintf(ctx->err, "Could not read file \"%s\".\n", path);
+        return false;
     }
+    return true;
+}
 
-    buffer[bytes_read] = '\0';
-    fclose(fp);
-    return buffer;
+static void free_file(source_t* source) {
+    if (source->mapped_size > 0)
+        munmap(source->buffer, source->mapped_size);
+    else
+        free(source->buffer);
 }
 
-static void debug_token(token_t* token) {
-    printf("[%d: %-18s]  '%.*s'\n",
-        token->line,
+static void debug_token(FILE* out, line_index_t* line_index, token_t* token,
+    uint32_t* line_hint) {
+    fprintf(out, "[%d: %-18s]  '%.*s'\n",
+        line_of_offset_near(line_index, token->offset, line_hint),
         stringify_token_type(token->type),
         token->length, token->start
     );
 }
 
-static void show_tokens(token_stream_t* token_stream) {
-    puts("==================================== Tokens ====================================");
-    for (int i = 0; i < token_stream->count; i++) {
-        debug_token(&token_stream->tokens[i]);
+static void show_tokens(compiler_ctx_t* ctx, token_stream_t* token_stream) {
+    fputs("==================================== Tokens ====================================\n", ctx->out);
+    uint32_t line_hint = 1;
+    for (uint32_t i = 0; i < token_stream->count; i++) {
+        token_t token = get_token(token_stream, i);
+        debug_token(ctx->out, &ctx->line_index, &token, &line_hint);
     }
-    puts("================================================================================\n");
+    fputs("================================================================================\n\n", ctx->out);
+
+}
 
+// Used when the token stream was not kept: scans the source again, printing
+// tokens as they come. Errors were already reported while parsing.
+static void show_tokens_streaming(compiler_ctx_t* ctx, const char* buffer) {
+    fputs("==================================== Tokens ====================================\n", ctx->out);
+    uint32_t line_hint = 1;
+    open_token_source(ctx, buffer, false);
+    for (;;) {
+        token_t token = pull_token(ctx);
+        debug_token(ctx->out, &ctx->line_index, &token, &line_hint);
+        // Only the text of the token just shown is kept.
+        ctx->token_stream.literals.size = 0;
+        if (token.type == TOKEN_EOF)
+            break;
+    }
+    fputs("================================================================================\n\n", ctx->out);
 }
 
-void compile(opts_t* opts) {
+static void show_phase(FILE* out, const char* phase, double seconds,
+    size_t bytes) {
+    fprintf(out, "%-10s %10.3f ms  %10.1f MB/s\n",
+        phase, seconds * 1e3, seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+}
 
-    if (opts->filename == NULL) {
-        fprintf(stderr, "No source file passed!");
+static void init_simd(opts_t* opts) {
+    simd_level_t level;
+    if (!simd_level_from_str(opts->simd, &level)) {
+        fprintf(stderr, "Unknown --simd level \"%s\".\n", opts->simd);
         exit(EXIT_FAILURE);
     }
+    if (!init_scanner_simd(level)) {
+        fprintf(stderr, "This CPU does not support --simd %s.\n", opts->simd);
+        exit(EXIT_FAILURE);
+    }
+}
 
-    char* buffer = read_file(opts->filename);
-    parser_t* parser = parse(buffer);
+static uint32_t jobs(opts_t* opts) {
+    if (opts->jobs > 0)
+        return opts->jobs;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (uint32_t)cpus : 1;
+}
+
+// Parses the bodies --decls skipped, in source order.
+static void parse_skipped_bodies(parser_t* parser) {
+    ast_node_list_t* stmts = &parser->ast->as.root.stmts->as.stmtslist.list;
+    for (uint32_t i = 0; i < stmts->count; i++) {
+        if (stmts->items[i]->type == NODE_FUNCDECL)
+            parse_function_body(parser, stmts->items[i]);
+    }
+}
+
+// Parses the declarations, and the bodies too when bodies is set. Skipping
+// a body by matching its braces recovers from errors differently than
+// parsing it, so on any error the file is parsed again in full and only
+// those diagnostics are shown.
+static parser_t* parse_decls(compiler_ctx_t* ctx,
+    token_stream_t* token_stream, bool bodies, uint32_t jobs) {
+    FILE* err = ctx->err;
+    char* err_buffer = NULL;
+    size_t err_size = 0;
+    ctx->err = open_memstream(&err_buffer, &err_size);
+    parser_t* parser = parse_declarations(ctx, token_stream);
+    if (bodies)
+        parse_skipped_bodies(parser);
+    fclose(ctx->err);
+    ctx->err = err;
+
+    if (parser->had_error) {
+        // The names go with the nodes.
+        free_sym_table(parser->sym_table);
+        parser->sym_table = NULL;
+        free_arena(&ctx->arena);
+        reset_interner(&ctx->interner);
+        parser = parse(ctx, token_stream, jobs);
+    } else {
+        fwrite(err_buffer, 1, err_size, err);
+    }
+    free(err_buffer);
+    return parser;
+}
+
+// Compiles a '\0' terminated buffer, printing to ctx->out and ctx->err.
+// start is when reading the source began. Returns false on errors.
+static bool compile_buffer(compiler_ctx_t* ctx, opts_t* opts,
+    const char* buffer, size_t size, uint32_t file_jobs, double start) {
+    token_stream_t* token_stream = NULL;
+    parser_t* parser = NULL;
+    // Bodies can only be skipped and parsed later from a kept token stream.
+    // Checking the syntax needs no token stream at all.
+    bool streaming = opts->syntax_only || (opts->stream && !opts->decls);
+
+    open_line_index(&ctx->line_index, buffer, size);
+    double read_end = now();
+    if (opts->syntax_only) {
+        parser = check_syntax(ctx, buffer);
+    } else if (streaming) {
+        parser = parse_streaming(ctx, buffer);
+    } else {
+        token_stream = get_tokens_parallel(ctx, buffer, size, file_jobs);
+    }
+    double scan_end = now();
+    if (!streaming) {
+        if (opts->decls) {
+            parser = parse_decls(ctx, token_stream, opts->ast, file_jobs);
+        } else {
+            parser = parse(ctx, token_stream, file_jobs);
+        }
+    }
+    double parse_end = now();
 
-    if (opts->tokens && parser->token_stream != NULL)
-        show_tokens(parser->token_stream);
+    if (opts->tokens) {
+        if (parser->token_stream != NULL)
+            show_tokens(ctx, parser->token_stream);
+        else
+            show_tokens_streaming(ctx, buffer);
+    }
 
-    if (opts->symbols && parser->global_sym_table != NULL)
-        show_sym_table(parser->global_sym_table);
+    if (opts->symbols && parser->sym_table != NULL)
+        show_sym_table(ctx->out, parser->sym_table);
 
-    if (has_semantic_errors(parser->ast, parser->global_sym_table)) {
+    double analysis_start = now();
+    // Without the bodies only the parser checked the declarations.
+    bool has_bodies = !opts->syntax_only && (!opts->decls || opts->ast);
+    if (has_bodies &&
+        has_semantic_errors(ctx, parser->ast, parser->sym_table, file_jobs)) {
         parser->had_error = true;
     }
+    double analysis_end = now();
 
-    if (opts->ast) {
+    if (opts->ast && has_bodies) {
         if (parser->ast == NULL || parser->had_error) {
-            printf("An error occured - AST not generated!\n");
+            fprintf(ctx->out, "An error occured - AST not generated!\n");
+        } else {
+            show_ast(ctx->out, &ctx->line_index, parser->ast);
+        }
+    }
+
+    if (opts->stats) {
+        fputs("================================== Statistics ==================================\n", ctx->out);
+        if (token_stream != NULL) {
+            fprintf(ctx->out, "bytes: %zu  lines: %u  tokens: %u  simd: %s  jobs: %u\n",
+                size, line_count(&ctx->line_index), token_stream->count,
+                simd_level_str(scanner_simd_level()), file_jobs);
+            show_phase(ctx->out, "read", read_end - start, size);
+            show_phase(ctx->out, "scan", scan_end - read_end, size);
+            show_phase(ctx->out, "parse", parse_end - scan_end, size);
         } else {
-            show_ast(parser->ast);
+            fprintf(ctx->out, "bytes: %zu  tokens: %u  simd: %s  (streaming)\n",
+                size, parser->scanned, simd_level_str(scanner_simd_level()));
+            show_phase(ctx->out, "read", read_end - start, size);
+            show_phase(ctx->out, "scan+parse", scan_end - read_end, size);
+        }
+        // No analysis runs without the bodies.
+        if (has_bodies)
+            show_phase(ctx->out, "analysis", analysis_end - analysis_start,
+                size);
+        show_phase(ctx->out, "total", (parse_end - start) +
+            (analysis_end - analysis_start), size);
+        fprintf(ctx->out,
+            "arena: %zu allocations  %zu bytes  %zu blocks  atoms: %u\n",
+            ctx->arena.allocations, ctx->arena.bytes, ctx->arena.blocks,
+            ctx->interner.count);
+        sym_stats_t sym_stats;
+        sym_table_stats(parser->sym_table, &sym_stats);
+        fprintf(ctx->out,
+            "symbols: %zu entries  %u scopes  %u slots  %u names  "
+            "probes: %.2f avg  %u max  scope depth: %u max\n",
+            sym_stats.entries, sym_stats.scopes, sym_stats.slots,
+            sym_stats.names, sym_stats.names == 0 ? 0.0 :
+                (double)sym_stats.probes / (double)sym_stats.names,
+            sym_stats.max_probes, sym_stats.max_depth);
+        fputs("================================================================================\n\n", ctx->out);
+    }
+
+    // The AST and the names go with the arena.
+    bool ok = !parser->had_error;
+    free_sym_table(parser->sym_table);
+    parser->sym_table = NULL;
+    free_arena(&ctx->arena);
+    reset_interner(&ctx->interner);
+    parser->ast = NULL;
+    return ok;
+}
+
+// Returns false when the file could not be read or has errors.
+bool compile_file(compiler_ctx_t* ctx, opts_t* opts, const char* path,
+    uint32_t file_jobs, size_t* bytes) {
+    source_t source;
+    double start = now();
+    if (!read_file(ctx, path, &source))
+        return false;
+    bool ok = compile_buffer(ctx, opts, source.buffer, source.size,
+        file_jobs, start);
+    free_file(&source);
+    *bytes = source.size;
+    return ok;
+}
+
+bool compile_source(compiler_ctx_t* ctx, opts_t* opts, const char* source,
+    size_t size) {
+    return compile_buffer(ctx, opts, source, size, 1, now());
+}
+
+static void* batch_worker(void* arg) {
+    batch_job_t* job = arg;
+    uint32_t count = job->opts->file_count;
+    compiler_ctx_t* ctx = create_compiler_ctx();
+
+    for (;;) {
+        uint32_t i = atomic_fetch_add(&job->next_file, 1);
+        if (i >= count)
+            break;
+        file_result_t* result = &job->results[i];
+        ctx->out = open_memstream(&result->out, &result->out_size);
+        ctx->err = open_memstream(&result->err, &result->err_size);
+        if (ctx->out == NULL || ctx->err == NULL) {
+            fprintf(stderr, "Could not allocate memory for file output\n");
+            exit(EXIT_FAILURE);
         }
+        result->ok = compile_file(ctx, job->opts, job->opts->filenames[i],
+            1, &result->bytes);
+        fclose(ctx->out);
+        fclose(ctx->err);
+    }
+
+    free_compiler_ctx(ctx);
+    return NULL;
+}
+
+// Files are taken in order by up to --jobs workers, each scanning its file
+// on its own thread. What a file prints is kept until the files before it
+// were printed, so the output does not depend on the number of workers.
+static bool compile_batch(opts_t* opts) {
+    uint32_t count = opts->file_count;
+    uint32_t workers = jobs(opts);
+    if (workers > count)
+        workers = count;
+
+    file_result_t* results = calloc(count, sizeof(file_result_t));
+    pthread_t* threads = malloc(workers * sizeof(pthread_t));
+    if (results == NULL || threads == NULL) {
+        fprintf(stderr, "Could not allocate memory for batch\n");
+        exit(EXIT_FAILURE);
     }
 
-    free(buffer);
-}
\ No newline at end of file
+    batch_job_t job = { .opts = opts, .results = results };
+    atomic_init(&job.next_file, 0);
+
+    double start = now();
+    for (uint32_t i = 0; i < workers; i++) {
+        if (pthread_create(&threads[i], NULL, batch_worker, &job) != 0) {
+            fprintf(stderr, "Could not create worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (uint32_t i = 0; i < workers; i++)
+        pthread_join(threads[i], NULL);
+    double end = now();
+
+    bool ok = true;
+    uint32_t failed = 0;
+    size_t bytes = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        file_result_t* result = &results[i];
+        printf("File: %s\n", opts->filenames[i]);
+        fwrite(result->out, 1, result->out_size, stdout);
+        fflush(stdout);
+        if (result->err_size > 0) {
+            fprintf(stderr, "File: %s\n", opts->filenames[i]);
+            fwrite(result->err, 1, result->err_size, stderr);
+        }
+        if (!result->ok) {
+            ok = false;
+            failed++;
+        }
+        bytes += result->bytes;
+        free(result->out);
+        free(result->err);
+    }
+
+    if (opts->stats) {
+        double seconds = end - start;
+        puts("=============================== Batch Statistics ===============================");
+        printf("files: %u  failed: %u  bytes: %zu  jobs: %u\n",
+            count, failed, bytes, workers);
+        printf("%-10s %10.3f ms  %10.1f MB/s  %10.1f files/s\n",
+            "total", seconds * 1e3,
+            seconds > 0 ? bytes / seconds / 1e6 : 0.0,
+            seconds > 0 ? count / seconds : 0.0);
+        puts("================================================================================\n");
+    }
+
+    free(threads);
+    free(results);
+    return ok;
+}
+
+bool compile(opts_t* opts) {
+
+    if (opts->server != NULL) {
+        init_simd(opts);
+        return serve(opts, jobs(opts));
+    }
+
+    if (opts->file_count == 0) {
+        fprintf(stderr, "No source file passed!");
+        exit(EXIT_FAILURE);
+    }
+
+    if (opts->client != NULL)
+        return run_client(opts);
+
+    init_simd(opts);
+
+    if (opts->file_count > 1)
+        return compile_batch(opts);
+
+    compiler_ctx_t* ctx = create_compiler_ctx();
+    size_t bytes;
+    bool ok = compile_file(ctx, opts, opts->filenames[0], jobs(opts), &bytes);
+    free_compiler_ctx(ctx);
+    return ok;
+}
@@ -1,8 +1,17 @@
 #ifndef cmm_compiler_h
 #define cmm_compiler_h
 
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include "opt_parser.h"
 
-void compile(opts_t* opts);
+typedef struct compiler_ctx compiler_ctx_t;
+
+bool compile(opts_t* opts);
+bool compile_file(compiler_ctx_t* ctx, opts_t* opts, const char* path,
+    uint32_t file_jobs, size_t* bytes);
+bool compile_source(compiler_ctx_t* ctx, opts_t* opts, const char* source,
+    size_t size);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "compiler_ctx.h"
+
+compiler_ctx_t* create_compiler_ctx() {
+    compiler_ctx_t* ctx = calloc(1, sizeof(compiler_ctx_t));
+    if (ctx == NULL) {
+        fprintf(stderr, "Could not allocate memory for compiler_ctx\n");
+        exit(EXIT_FAILURE);
+    }
+    ctx->interner.arena = &ctx->arena;
+    ctx->out = stdout;
+    ctx->err = stderr;
+    return ctx;
+}
+
+// The symbol tables are left to the caller.
+void free_compiler_ctx(compiler_ctx_t* ctx) {
+    free_arena(&ctx->arena);
+    free_interner(&ctx->interner);
+    free_ast_node_stack(&ctx->parser.nodes);
+    free(ctx->parser.deferred);
+    free_token_stream(&ctx->token_stream);
+    free_line_index(&ctx->line_index);
+    free(ctx);
+}
@@ -0,0 +1,37 @@
+#ifndef cmm_compiler_ctx_h
+#define cmm_compiler_ctx_h
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "token.h"
+#include "line_index.h"
+#include "arena.h"
+#include "intern.h"
+#include "scanner.h"
+#include "parser.h"
+#include "analyzer.h"
+
+// State of one compilation. Nothing is shared between contexts, so separate
+// compilations can run on separate threads, and a context can be reused for
+// the next file.
+struct compiler_ctx {
+    // Where dumps and diagnostics go, stdout and stderr unless redirected.
+    FILE* out;
+    FILE* err;
+    line_index_t line_index;
+    // Backs the AST, freed once the compilation is done.
+    arena_t arena;
+    // Identifier names, kept in the arena.
+    interner_t interner;
+    scanner_t scanner;
+    token_stream_t token_stream;
+    parser_t parser;
+    analyzer_t analyzer;
+    // Set while a function definition is entered in the symbol table.
+    bool defining_a_declaration;
+};
+
+compiler_ctx_t* create_compiler_ctx();
+void free_compiler_ctx(compiler_ctx_t* ctx);
+
+#endif
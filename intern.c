@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "intern.h"
+
+// djb2
+uint32_t hash_name(const char* name, uint32_t length) {
+    uint32_t hash = 5381;
+    for (uint32_t i = 0; i < length; i++)
+        hash = ((hash << 5) + hash) + (unsigned char)name[i];
+    return hash;
+}
+
+static atom_t** alloc_slots(uint32_t capacity) {
+    atom_t** slots = calloc(capacity, sizeof(atom_t*));
+    if (slots == NULL) {
+        fprintf(stderr, "Could not allocate memory for interner\n");
+        exit(EXIT_FAILURE);
+    }
+    return slots;
+}
+
+static atom_t** find_slot(atom_t** slots, uint32_t capacity,
+    const char* name, uint32_t length, uint32_t hash) {
+    uint32_t mask = capacity - 1;
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        atom_t* atom = slots[i];
+        if (atom == NULL)
+            return &slots[i];
+        if (atom->hash == hash && atom->length == length &&
+            memcmp(atom->name, name, length) == 0)
+            return &slots[i];
+    }
+}
+
+static void grow(interner_t* interner) {
+    uint32_t capacity = interner->capacity * 2;
+    atom_t** slots = alloc_slots(capacity);
+    for (uint32_t i = 0; i < interner->capacity; i++) {
+        atom_t* atom = interner->slots[i];
+        if (atom != NULL)
+            *find_slot(slots, capacity, atom->name, atom->length,
+                atom->hash) = atom;
+    }
+    free(interner->slots);
+    interner->slots = slots;
+    interner->capacity = capacity;
+}
+
+// Returns the atom for the length bytes at name, adding it the first time.
+atom_t* intern(interner_t* interner, const char* name, uint32_t length) {
+    if (interner->slots == NULL) {
+        interner->capacity = INTERNER_INITIAL_CAPACITY;
+        interner->slots = alloc_slots(interner->capacity);
+    }
+
+    uint32_t hash = hash_name(name, length);
+    atom_t** slot = find_slot(interner->slots, interner->capacity,
+        name, length, hash);
+    if (*slot != NULL)
+        return *slot;
+
+    atom_t* atom = arena_alloc(interner->arena, sizeof(atom_t) + length + 1);
+    atom->id = interner->count;
+    atom->hash = hash;
+    atom->length = length;
+    memcpy(atom->name, name, length);
+    *slot = atom;
+
+    if (++interner->count * 2 > interner->capacity)
+        grow(interner);
+    return atom;
+}
+
+// Returns the atom for name or NULL if it was never interned. Does not
+// change the interner, so threads may call it together while nobody interns.
+atom_t* find_atom(const interner_t* interner, const char* name,
+    uint32_t length) {
+    if (interner->slots == NULL)
+        return NULL;
+    return *find_slot(interner->slots, interner->capacity, name, length,
+        hash_name(name, length));
+}
+
+// Forgets every atom but keeps the table for the next compilation.
+void reset_interner(interner_t* interner) {
+    if (interner->slots != NULL)
+        memset(interner->slots, 0, interner->capacity * sizeof(atom_t*));
+    interner->count = 0;
+}
+
+void free_interner(interner_t* interner) {
+    free(interner->slots);
+    interner->slots = NULL;
+    interner->capacity = 0;
+    interner->count = 0;
+}
@@ -0,0 +1,36 @@
+#ifndef cmm_intern_h
+#define cmm_intern_h
+
+#include <stdint.h>
+#include "arena.h"
+
+// Starting number of slots, a power of two. The table doubles when half full.
+#define INTERNER_INITIAL_CAPACITY 1024
+
+// A name stored once per compilation. Equal names are the same atom, so they
+// compare by pointer, and the hash is computed once.
+typedef struct {
+    // Numbered from 0 in the order the names were first seen.
+    uint32_t id;
+    uint32_t hash;
+    uint32_t length;
+    char name[];
+} atom_t;
+
+// Atoms live in the arena and go with it: reset_interner() must be called
+// whenever the arena is freed.
+typedef struct {
+    arena_t* arena;
+    atom_t** slots;
+    uint32_t capacity;
+    uint32_t count;
+} interner_t;
+
+uint32_t hash_name(const char* name, uint32_t length);
+atom_t* intern(interner_t* interner, const char* name, uint32_t length);
+atom_t* find_atom(const interner_t* interner, const char* name,
+    uint32_t length);
+void reset_interner(interner_t* interner);
+void free_interner(interner_t* interner);
+
+#endif
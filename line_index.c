@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "line_index.h"
+#include "scanner_simd.h"
+
+static void* grow_array(void* array, size_t capacity, size_t item_size) {
+    array = realloc(array, capacity * item_size);
+    if (array == NULL) {
+        fprintf(stderr, "Could not allocate memory for line_index\n");
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
+
+// Records the line starts with the same newline search the scanner uses to
+// skip comments. A '\0' before the end of the source does not stop it.
+static void build_line_index(line_index_t* line_index) {
+    const char* end = line_index->source + line_index->size;
+    uint32_t capacity =
+        (uint32_t)(line_index->size / BYTES_PER_LINE_ESTIMATE) + 1;
+
+    line_index->starts = grow_array(NULL, capacity, sizeof(uint32_t));
+    line_index->starts[0] = 0;
+    line_index->count = 1;
+
+    for (const char* p = line_index->source;; p++) {
+        p = scanner_simd.find_line_end(p);
+        if (p >= end)
+            break;
+        if (*p != '\n')
+            continue;
+        if (line_index->count == capacity) {
+            capacity *= 2;
+            line_index->starts = grow_array(line_index->starts,
+                capacity, sizeof(uint32_t));
+        }
+        line_index->starts[line_index->count++] =
+            (uint32_t)(p - line_index->source) + 1;
+    }
+}
+
+static line_index_t* get_line_index(line_index_t* line_index) {
+    if (line_index->starts == NULL)
+        build_line_index(line_index);
+    return line_index;
+}
+
+// Sets the source the offsets refer to, nothing is scanned until a line is
+// asked for.
+void open_line_index(line_index_t* line_index, const char* source,
+    size_t size) {
+    free_line_index(line_index);
+    line_index->source = source;
+    line_index->size = size;
+}
+
+void free_line_index(line_index_t* line_index) {
+    free(line_index->starts);
+    line_index->starts = NULL;
+    line_index->count = 0;
+}
+
+uint32_t line_count(line_index_t* line_index) {
+    return get_line_index(line_index)->count;
+}
+
+uint32_t line_of_offset(line_index_t* line_index, uint32_t offset) {
+    line_index_t* index = get_line_index(line_index);
+    // Number of line starts at or before offset.
+    uint32_t low = 0;
+    uint32_t high = index->count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (index->starts[mid] <= offset)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// Same as line_of_offset() but starts from the line found by the previous
+// call, which is cheap when the offsets are visited mostly in order.
+uint32_t line_of_offset_near(line_index_t* line_index, uint32_t offset,
+    uint32_t* hint) {
+    line_index_t* index = get_line_index(line_index);
+    uint32_t line = *hint;
+    if (line == 0 || line > index->count)
+        line = 1;
+    while (line > 1 && index->starts[line - 1] > offset)
+        line--;
+    while (line < index->count && index->starts[line] <= offset)
+        line++;
+    *hint = line;
+    return line;
+}
+
+uint32_t column_of_offset(line_index_t* line_index, uint32_t offset) {
+    uint32_t line = line_of_offset(line_index, offset);
+    return offset - line_index->starts[line - 1] + 1;
+}
+
+// Prefix of every diagnostic.
+void print_location(FILE* fp, line_index_t* line_index, uint32_t offset) {
+    fprintf(fp, "Line: %u:%u: ", line_of_offset(line_index, offset),
+        column_of_offset(line_index, offset));
+}
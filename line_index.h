@@ -0,0 +1,31 @@
+#ifndef cmm_line_index_h
+#define cmm_line_index_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Used to size the line start array up front from the input size.
+#define BYTES_PER_LINE_ESTIMATE 32
+
+// Tokens and AST nodes only keep the byte offset where they start. Lines and
+// columns are computed from the offsets of the line starts, which are found
+// the first time a diagnostic or a dump asks for one.
+typedef struct {
+    const char* source;
+    size_t size;
+    uint32_t count;
+    uint32_t* starts;
+} line_index_t;
+
+void open_line_index(line_index_t* line_index, const char* source,
+    size_t size);
+void free_line_index(line_index_t* line_index);
+uint32_t line_count(line_index_t* line_index);
+uint32_t line_of_offset(line_index_t* line_index, uint32_t offset);
+uint32_t line_of_offset_near(line_index_t* line_index, uint32_t offset,
+    uint32_t* hint);
+uint32_t column_of_offset(line_index_t* line_index, uint32_t offset);
+void print_location(FILE* fp, line_index_t* line_index, uint32_t offset);
+
+#endif
@@ -7,7 +7,9 @@
 
 
 int main(int argc, char** argv) {
-    opts_t* opts = parse_opts(argc, argv);
-    compile(opts);
+    opts_t opts;
+    parse_opts(argc, argv, &opts);
+    if (!compile(&opts))
+        exit(EXIT_FAILURE);
     exit(EXIT_SUCCESS);
 }
\ No newline at end of file
@@ -2,55 +2,175 @@
 #include <stdlib.h>
 #include <getopt.h>
 #include <stdbool.h>
+#include <string.h>
+#include <errno.h>
 #include "opt_parser.h"
 
-opts_t opts;
+#define MAX_PATH_LENGTH 4096
+// Larger --jobs values are clamped, the thread arrays are sized from it.
+#define MAX_JOBS 256
 
 static void print_help(const char* prog_name) {
     printf(
-        "Usage: %s [options] <filename>\n"       \
-        "    --help         Print help menu\n"   \
-        "    --token        Show tokens\n"       \
-        "    --ast          Show generated AST\n"\
-        "    --symbols      Show symbol table\n",\
+        "Usage: %s [options] <filename|@listfile>...\n"        \
+        "    --help          Print help menu\n"                 \
+        "    --token         Show tokens\n"                     \
+        "    --ast           Show generated AST\n"              \
+        "    --symbols       Show symbol table\n"               \
+        "    --stats         Show time and throughput per phase\n"\
+        "    --stream        Scan tokens on demand while parsing\n"\
+        "    --decls         Parse only declarations, function bodies are\n"\
+        "                    parsed for --ast and otherwise not checked\n"\
+        "    --syntax-only   Only check the syntax and the declarations,\n"\
+        "                    building no AST for function bodies\n"\
+        "    --simd <isa>    Scanner fast paths: auto, scalar, sse2, avx2\n"\
+        "    --jobs <n>      Use n threads, \"auto\" for one per CPU: to scan\n"\
+        "                    and parse one file, or to compile several\n"\
+        "                    files at once\n"                   \
+        "    --server <sock> Compile requests sent to a Unix socket, with\n"\
+        "                    --jobs workers\n"                 \
+        "    --client <sock> Have the server at sock compile the files,\n"\
+        "                    \"-\" sends standard input\n",      \
         prog_name
     );
 }
 
-opts_t* parse_opts(int argc, char** argv) {
-    opts.tokens = false;
-    opts.ast = false;
-    opts.symbols = false;
-    opts.filename = NULL;
+// Returns 0, which stands for one job per CPU, for "auto". Anything but a
+// positive number is an error.
+static uint32_t parse_jobs(const char* str) {
+    if (strcmp(str, "auto") == 0)
+        return 0;
+    char* end;
+    errno = 0;
+    unsigned long jobs = strtoul(str, &end, 10);
+    if (str[0] < '0' || str[0] > '9' || *end != '\0' || jobs == 0) {
+        fprintf(stderr, "Invalid --jobs count \"%s\".\n", str);
+        exit(EXIT_FAILURE);
+    }
+    if (errno == ERANGE || jobs > MAX_JOBS)
+        jobs = MAX_JOBS;
+    return (uint32_t)jobs;
+}
+
+static void add_filename(opts_t* opts, uint32_t* capacity, char* filename) {
+    if (opts->file_count == *capacity) {
+        *capacity = *capacity < 8 ? 8 : *capacity * 2;
+        opts->filenames = realloc(opts->filenames,
+            *capacity * sizeof(char*));
+        if (opts->filenames == NULL) {
+            fprintf(stderr, "Could not allocate memory for filenames\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    opts->filenames[opts->file_count++] = filename;
+}
+
+// A response file lists one source per line, so paths may hold spaces.
+// Blank lines are skipped.
+static void read_response_file(opts_t* opts, uint32_t* capacity,
+    const char* path) {
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    char* line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    for (uint32_t line_number = 1;
+        (length = getline(&line, &line_capacity, fp)) != -1; line_number++) {
+        if (length > 0 && line[length - 1] == '\n')
+            line[--length] = '\0';
+        if (length > 0 && line[length - 1] == '\r')
+            line[--length] = '\0';
+        if (length == 0)
+            continue;
+        if (length >= MAX_PATH_LENGTH) {
+            fprintf(stderr, "Path on line %u of \"%s\" is too long.\n",
+                line_number, path);
+            exit(EXIT_FAILURE);
+        }
+        char* copy = strdup(line);
+        if (copy == NULL) {
+            fprintf(stderr, "Could not allocate memory for filenames\n");
+            exit(EXIT_FAILURE);
+        }
+        add_filename(opts, capacity, copy);
+    }
+    free(line);
+    fclose(fp);
+}
+
+void parse_opts(int argc, char** argv, opts_t* opts) {
+    opts->tokens = false;
+    opts->ast = false;
+    opts->symbols = false;
+    opts->stats = false;
+    opts->stream = false;
+    opts->decls = false;
+    opts->syntax_only = false;
+    opts->simd = "auto";
+    opts->jobs = 1;
+    opts->server = NULL;
+    opts->client = NULL;
+    opts->filenames = NULL;
+    opts->file_count = 0;
 
     static struct option long_opts[] = {
         {"help",      no_argument, 0, 'h'},
         {"tokens",    no_argument, 0, 't'},
         {"ast",       no_argument, 0, 'a'},
         {"symbols",   no_argument, 0, 's'},
+        {"stats",     no_argument, 0, 'S'},
+        {"stream",    no_argument, 0, 'm'},
+        {"decls",     no_argument, 0, 'd'},
+        {"syntax-only", no_argument, 0, 'y'},
+        {"simd",      required_argument, 0, 'i'},
+        {"jobs",      required_argument, 0, 'j'},
+        {"server",    required_argument, 0, 'V'},
+        {"client",    required_argument, 0, 'c'},
         {0,           0,           0,  0 }
     };
 
     int opt = 0;
     int long_idx = 0;
 
-    while ((opt = getopt_long(argc, argv, "htas", long_opts, &long_idx)) != -1) {
+    while ((opt = getopt_long(argc, argv, "htasSmdyi:j:V:c:", long_opts, &long_idx)) != -1) {
         switch (opt) {
             case 'h' :
                 print_help(argv[0]);
                 exit(EXIT_SUCCESS);
                 break;
 
-            case 't' : opts.tokens  = true; break;
-            case 'a' : opts.ast     = true; break;
-            case 's' : opts.symbols = true; break;
+            case 't' : opts->tokens  = true; break;
+            case 'a' : opts->ast     = true; break;
+            case 's' : opts->symbols = true; break;
+            case 'S' : opts->stats   = true; break;
+            case 'm' : opts->stream  = true; break;
+            case 'd' : opts->decls   = true; break;
+            case 'y' : opts->syntax_only = true; break;
+            case 'i' : opts->simd    = optarg; break;
+            case 'j' : opts->jobs    = parse_jobs(optarg); break;
+            case 'V' : opts->server  = optarg; break;
+            case 'c' : opts->client  = optarg; break;
 
             default:
                 exit(EXIT_FAILURE);
         }
     }
 
-    opts.filename = argv[optind];
+    // A syntax check builds no AST for the bodies to show.
+    if (opts->syntax_only && opts->ast) {
+        fprintf(stderr, "--ast cannot be combined with --syntax-only.\n");
+        exit(EXIT_FAILURE);
+    }
 
-    return &opts;
+    uint32_t capacity = 0;
+    for (int i = optind; i < argc; i++) {
+        if (argv[i][0] == '@')
+            read_response_file(opts, &capacity, argv[i] + 1);
+        else
+            add_filename(opts, &capacity, argv[i]);
+    }
 }
@@ -2,14 +2,28 @@
 #define cmm_opt_parser_h
 
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct {
     bool tokens;
     bool ast;
     bool symbols;
-    char* filename;
+    bool stats;
+    bool stream;
+    bool decls;
+    bool syntax_only;
+    // Scanner and parser threads for one file, worker threads for several,
+    // 0 for one per online CPU ("auto").
+    uint32_t jobs;
+    char* simd;
+    // Unix socket paths of --server and --client, NULL when not given.
+    char* server;
+    char* client;
+    // Sources in the order given, "@file" arguments expanded.
+    char** filenames;
+    uint32_t file_count;
 } opts_t;
 
-opts_t* parse_opts(int argc, char** argv);
+void parse_opts(int argc, char** argv, opts_t* opts);
 
 #endif
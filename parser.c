@@ -2,17 +2,35 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
-#include <stdarg.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "parser.h"
 #include "scanner.h"
 #include "ast.h"
 #include "sym_table.h"
 #include "ast_show.h"
-
-parser_t parser;
-
-static void parse_stmt(ast_node_t* parent);
-static ast_node_t* parse_expr();
+#include "line_index.h"
+#include "compiler_ctx.h"
+
+static void parse_stmt(parser_t* parser);
+static ast_node_t* parse_expr(parser_t* parser);
+
+// A set of token types, one bit per type.
+typedef uint64_t token_set_t;
+_Static_assert(TOKEN_EOF < 64, "token types must fit in a token_set_t");
+#define TOKEN_BIT(type) ((token_set_t)1 << (type))
+
+#define TYPE_SET (TOKEN_BIT(TOKEN_INT) | TOKEN_BIT(TOKEN_CHAR))
+// What a global declaration starts with, where synchronize_global() stops.
+#define DECL_SET (TYPE_SET | TOKEN_BIT(TOKEN_VOID))
+// Where synchronize() stops inside a function.
+#define STMT_SYNC_SET \
+    (TOKEN_BIT(TOKEN_IF) | TOKEN_BIT(TOKEN_WHILE) | \
+     TOKEN_BIT(TOKEN_FOR) | TOKEN_BIT(TOKEN_RETURN))
+// What a statement starts with.
+#define STMT_SET \
+    (STMT_SYNC_SET | TOKEN_BIT(TOKEN_IDENT) | \
+     TOKEN_BIT(TOKEN_LEFT_BRACE) | TOKEN_BIT(TOKEN_SEMICOLON))
 
 /*
 static void fatal_error(const char* msg) {
@@ -20,488 +38,607 @@ static void fatal_error(const char* msg) {
     exit(EXIT_FAILURE);
 }
 */
-static token_t* peek(uint32_t dist) {
-    if ((parser.cur_position + dist) >= parser.token_stream->count)
-        return &parser.token_stream->tokens[parser.token_stream->count - 1];
-    else
-        return &parser.token_stream->tokens[parser.cur_position + dist];
+static bool is_streaming(parser_t* parser) {
+    return parser->token_stream == NULL;
+}
+
+static uint32_t clamp_position(parser_t* parser, uint32_t position) {
+    // Anything past the end reads as the EOF token.
+    if (position >= parser->token_stream->count)
+        return parser->token_stream->count - 1;
+    return position;
+}
+
+// Pulls tokens from the scanner until position is in the lookahead buffer.
+// The parser never looks further back than last_token() nor further ahead
+// than peek_type(1), so a few slots are enough for any file size.
+static token_t* lookahead_at(parser_t* parser, uint32_t position) {
+    while (parser->scanned <= position) {
+        if (parser->scanned - parser->last_string >= LOOKAHEAD_SIZE)
+            parser->ctx->token_stream.literals.size = 0;
+        token_t* token =
+            &parser->lookahead[parser->scanned & (LOOKAHEAD_SIZE - 1)];
+        *token = pull_token(parser->ctx);
+        if (token->type == TOKEN_STRING)
+            parser->last_string = parser->scanned;
+        parser->scanned++;
+    }
+    return &parser->lookahead[position & (LOOKAHEAD_SIZE - 1)];
+}
+
+static token_type_t peek_type(parser_t* parser, uint32_t dist) {
+    if (is_streaming(parser))
+        return lookahead_at(parser, parser->cur_position + dist)->type;
+    return parser->token_stream->types[
+        clamp_position(parser, parser->cur_position + dist)];
 }
 /*
 static void debug_token(token_t* token) {
     printf("[%d: %-18s]  '%.*s'\n",
-        token->line,
+        line_of_offset(&parser->ctx->line_index, token->offset),
         stringify_token_type(token->type),
         token->length, token->start
     );
 }
+*/
 
-static void show_tokens(token_stream_t* token_stream) {
-    for (int i = 0; i < token_stream->count; i++) {
-        debug_token(&token_stream->tokens[i]);
-    }
-    printf("\n\n");
+static void advance(parser_t* parser) {
+    if (is_streaming(parser) || parser->cur_position < parser->token_stream->count)
+        parser->cur_position++;
 }
-*/
 
-static void advance() {
-    if (parser.cur_position < parser.token_stream->count)
-        parser.cur_position++;
+static token_t token_at(parser_t* parser, uint32_t position) {
+    if (is_streaming(parser))
+        return *lookahead_at(parser, position);
+    return get_token(parser->token_stream, clamp_position(parser, position));
 }
 
-static token_t* last_token() {
-    if ((int32_t)parser.cur_position > 0)
-        return &parser.token_stream->tokens[parser.cur_position - 1];
+static token_t last_token(parser_t* parser) {
+    if ((int32_t)parser->cur_position > 0)
+        return token_at(parser, parser->cur_position - 1);
     else {
         // EOF token.
-        return &parser.token_stream->tokens[parser.token_stream->count];
+        return token_at(parser,
+            is_streaming(parser) ? 0 : parser->token_stream->count - 1);
     }
 }
 
-static token_t* next_token() {
-    if (parser.cur_position < parser.token_stream->count) {
-        advance();
-        return last_token();
+static token_t next_token(parser_t* parser) {
+    if (is_streaming(parser) || parser->cur_position < parser->token_stream->count) {
+        advance(parser);
+        return last_token(parser);
     }
     else {
         // EOF token.
-        return &parser.token_stream->tokens[parser.token_stream->count];
+        return token_at(parser, parser->token_stream->count - 1);
     }
 }
 
-static void error_at(token_t* token, const char* msg) {
-    if (parser.panic_mode)
+static void error_at(parser_t* parser, token_t token, const char* msg) {
+    if (parser->panic_mode)
         return;
 
-    parser.panic_mode = true;
-    parser.had_error = true;
+    parser->panic_mode = true;
+    parser->had_error = true;
 
-    fprintf(stderr, "Line: %d: error", token->line);
+    print_location(parser->ctx->err, &parser->ctx->line_index, token.offset);
+    fprintf(parser->ctx->err, "error");
 
-    if (token->type == TOKEN_EOF) {
-        fprintf(stderr, " at end");
-    } else if (token->type == TOKEN_ERROR) {
+    if (token.type == TOKEN_EOF) {
+        fprintf(parser->ctx->err, " at end");
+    } else if (token.type == TOKEN_ERROR) {
     // Nothing.
     } else {
-        fprintf(stderr, " at '%.*s'", token->length, token->start);
+        fprintf(parser->ctx->err, " at '%.*s'", token.length, token.start);
     }
-    fprintf(stderr, ": %s\n", msg);
+    fprintf(parser->ctx->err, ": %s\n", msg);
 }
 
-bool match(token_type_t type) {
+static bool match(parser_t* parser, token_type_t type) {
     char msg[128];
-    token_t* token = next_token();
-    if (token->type == type) {
+    token_t token = next_token(parser);
+    if (token.type == type) {
         return true;
     } else {
         sprintf(msg, "expected '%s'", token_type_str(type));
-        error_at(token, msg);
+        error_at(parser, token, msg);
         return false;
     }
 }
 
-bool is_next_token(token_type_t type) {
-    return peek(0)->type == type;
+static bool is_next_token(parser_t* parser, token_type_t type) {
+    return peek_type(parser, 0) == type;
 }
 
-bool is_next_token_any(int n, ...) {
-    va_list args;
-    va_start(args, n);
-    for (int i = 0; i < n; i++)
-        if (peek(0)->type == va_arg(args, int))
-            return true;
-    va_end(args);
-    return false;
+static bool is_next_token_in(parser_t* parser, token_set_t set) {
+    return (TOKEN_BIT(peek_type(parser, 0)) & set) != 0;
 }
 
-static void synchronize() {
-    parser.panic_mode = false;
+static void synchronize(parser_t* parser) {
+    parser->panic_mode = false;
 
-    while (peek(0)->type != TOKEN_EOF) {
-        if (is_next_token_any(4,
-            TOKEN_FOR, TOKEN_IF, TOKEN_WHILE, TOKEN_RETURN))
-                return;
+    while (peek_type(parser, 0) != TOKEN_EOF) {
+        if (is_next_token_in(parser, STMT_SYNC_SET))
+            return;
 
         /*
-        if ((int32_t)parser.cur_position > 0)
-            if (last_token()->type == TOKEN_SEMICOLON)
+        if ((int32_t)parser->cur_position > 0)
+            if (last_token(parser).type == TOKEN_SEMICOLON)
                 return;
         */
 
-        advance();
+        advance(parser);
     }
 }
 
-static void synchronize_global() {
-    parser.panic_mode = false;
+static void synchronize_global(parser_t* parser) {
+    parser->panic_mode = false;
 
-    while (peek(0)->type != TOKEN_EOF) {
-        bool next_is_char_int_void = is_next_token_any(3,
-            TOKEN_VOID, TOKEN_CHAR, TOKEN_INT);
+    while (peek_type(parser, 0) != TOKEN_EOF) {
+        bool next_is_char_int_void = is_next_token_in(parser, DECL_SET);
 
-        if ((int32_t)parser.cur_position > 0)
-            if (last_token()->type == TOKEN_SEMICOLON && next_is_char_int_void)
+        if ((int32_t)parser->cur_position > 0)
+            if (last_token(parser).type == TOKEN_SEMICOLON && next_is_char_int_void)
                 return;
-        advance();
+        advance(parser);
     }
 }
 
-static void check_use_before_decl(ast_node_t* ident) {
-    char* sym = ident->as.ident.value;
+// Evaluates to node, which is not evaluated while only recognizing.
+#define BUILD(parser, node) \
+    ((parser)->recognize_only ? &(parser)->placeholder : (node))
+
+static ast_node_t* create_ident(parser_t* parser, token_t* token) {
+    if (parser->recognize_only)
+        return &parser->placeholder;
+    atom_t* atom = parser->atoms_interned ?
+        find_atom(&parser->ctx->interner, token->start, token->length) :
+        intern(&parser->ctx->interner, token->start, token->length);
+    return create_ast_node_ident(parser->arena, token, atom);
+}
+
+// Children are pushed on parser->nodes until the list they belong to ends.
+static uint32_t begin_list(parser_t* parser) {
+    return parser->nodes.count;
+}
+
+static void add_node(parser_t* parser, ast_node_t* node) {
+    if (!parser->recognize_only)
+        push_ast_node(&parser->nodes, node);
+}
+
+static void end_list(parser_t* parser, uint32_t base, ast_node_t* list) {
+    if (!parser->recognize_only)
+        pop_ast_node_list(parser->arena, &parser->nodes, base, list);
+}
 
-    if (sym_lookup(parser.cur_sym_table, sym) != NULL)
+// Binds ident to the local or global it names, later phases read the entry
+// from the node instead of looking the name up again.
+static void resolve_ident(parser_t* parser, ast_node_t* ident) {
+    if (parser->recognize_only)
+        return;
+    ident->as.ident.entry = sym_lookup(parser->sym_table, ident->as.ident.atom);
+}
+
+static void check_use_before_decl(parser_t* parser, ast_node_t* ident) {
+    if (parser->recognize_only)
         return;
 
-    if (sym_lookup(parser.global_sym_table, sym) != NULL)
+    // Locals are always declared before the statements. Globals declared
+    // after the use do not count, they are only in the table when function
+    // bodies are parsed last, see parse().
+    sym_entry_t* entry = ident->as.ident.entry;
+    if (entry != NULL && entry->declared_offset < ident->offset)
         return;
 
-    fprintf(stderr,
-        "Line: %d: error: \"%s\" used before a declaration\n",
-        ident->line, sym);
+    print_location(parser->ctx->err, &parser->ctx->line_index, ident->offset);
+    fprintf(parser->ctx->err, "error: \"%s\" used before a declaration\n",
+        ident->as.ident.atom->name);
 
-    parser.had_error = true;
+    parser->had_error = true;
 }
 
-static ast_node_t* parse_funccall(ast_node_t* ident) {
-    match(TOKEN_LEFT_PAREN);
-    ast_node_t* node = create_ast_node_funccall(ident);
-
-    check_use_before_decl(ident);
+static ast_node_t* parse_funccall(parser_t* parser, ast_node_t* ident) {
+    match(parser, TOKEN_LEFT_PAREN);
+    ast_node_t* node = BUILD(parser,
+        create_ast_node_funccall(parser->arena, ident));
+
+    check_use_before_decl(parser, ident);
+    if (!parser->recognize_only) {
+        // Only globals are functions, a local of the same name is not
+        // what is called.
+        node->as.funccall.entry = sym_lookup_global(parser->sym_table,
+            ident->as.ident.atom);
+    }
 
-    if (!is_next_token(TOKEN_RIGHT_PAREN)) {
-        add_param(node->as.funccall.params, parse_expr());
+    uint32_t base = begin_list(parser);
+    if (!is_next_token(parser, TOKEN_RIGHT_PAREN)) {
+        add_node(parser, parse_expr(parser));
 
-        while (is_next_token(TOKEN_COMMA)) {
-            match(TOKEN_COMMA);
-            add_param(node->as.funccall.params, parse_expr());
+        while (is_next_token(parser, TOKEN_COMMA)) {
+            match(parser, TOKEN_COMMA);
+            add_node(parser, parse_expr(parser));
         }
     }
-    match(TOKEN_RIGHT_PAREN);
+    end_list(parser, base, node->as.funccall.params);
+    match(parser, TOKEN_RIGHT_PAREN);
     return node;
 }
 
-static ast_node_t* parse_arrayaccess(ast_node_t* ident) {
-    match(TOKEN_LEFT_BRACKET);
-    ast_node_t* node = create_ast_node_arrayaccess(ident, parse_expr());
-    match(TOKEN_RIGHT_BRACKET);
+static ast_node_t* parse_arrayaccess(parser_t* parser, ast_node_t* ident) {
+    match(parser, TOKEN_LEFT_BRACKET);
+    ast_node_t* index = parse_expr(parser);
+    ast_node_t* node = BUILD(parser,
+        create_ast_node_arrayaccess(parser->arena, ident, index));
+    match(parser, TOKEN_RIGHT_BRACKET);
     return node;
 }
 
-static ast_node_t* parse_assign() {
+static ast_node_t* parse_assign(parser_t* parser) {
     ast_node_t* node_assign = NULL;
 
-    if (match(TOKEN_IDENT)) {
-
-        token_t* token_ident = last_token();
-        ast_node_t* node_ident = create_ast_node_ident(token_ident);
-
-        check_use_before_decl(node_ident);
-
-        if (is_next_token(TOKEN_LEFT_BRACKET)) {
-            ast_node_t* arrayaccess = parse_arrayaccess(node_ident);
-            match(TOKEN_EQUAL);
-            node_assign = create_ast_node_assign(arrayaccess, parse_expr());
-        } else if (is_next_token(TOKEN_EQUAL)) {
-            match(TOKEN_EQUAL);
-            node_assign = create_ast_node_assign(node_ident, parse_expr());
+    if (match(parser, TOKEN_IDENT)) {
+
+        token_t token_ident = last_token(parser);
+        ast_node_t* node_ident = create_ident(parser, &token_ident);
+
+        resolve_ident(parser, node_ident);
+        check_use_before_decl(parser, node_ident);
+
+        if (is_next_token(parser, TOKEN_LEFT_BRACKET)) {
+            ast_node_t* arrayaccess = parse_arrayaccess(parser, node_ident);
+            match(parser, TOKEN_EQUAL);
+            ast_node_t* value = parse_expr(parser);
+            node_assign = BUILD(parser,
+                create_ast_node_assign(parser->arena, arrayaccess, value));
+        } else if (is_next_token(parser, TOKEN_EQUAL)) {
+            match(parser, TOKEN_EQUAL);
+            ast_node_t* value = parse_expr(parser);
+            node_assign = BUILD(parser,
+                create_ast_node_assign(parser->arena, node_ident, value));
         }
     }
     return node_assign;
 }
 
-static ast_node_t* parse_factor() {
-    //printf("parse_factor> "); debug_token(peek(0));
+// How tightly an operator holds its operands, from loosest to tightest.
+typedef enum {
+    BP_NONE,
+    BP_COMPARISON,      // == != < <= > >=
+    BP_ADDITIVE,        // + - ||
+    BP_MULTIPLICATIVE,  // * / &&
+    BP_UNARY            // ! and a leading -
+} binding_power_t;
+
+// Binding power of each binary operator, BP_NONE for other tokens.
+static const uint8_t binary_power[TOKEN_EOF + 1] = {
+    [TOKEN_EQUAL_EQUAL] = BP_COMPARISON, [TOKEN_BANG_EQUAL] = BP_COMPARISON,
+    [TOKEN_LESS] = BP_COMPARISON, [TOKEN_LESS_EQUAL] = BP_COMPARISON,
+    [TOKEN_GREATER] = BP_COMPARISON, [TOKEN_GREATER_EQUAL] = BP_COMPARISON,
+    [TOKEN_PLUS] = BP_ADDITIVE, [TOKEN_MINUS] = BP_ADDITIVE,
+    [TOKEN_OR] = BP_ADDITIVE,
+    [TOKEN_STAR] = BP_MULTIPLICATIVE, [TOKEN_SLASH] = BP_MULTIPLICATIVE,
+    [TOKEN_AND] = BP_MULTIPLICATIVE,
+};
+
+static ast_node_t* parse_expr_bp(parser_t* parser, binding_power_t min_bp);
+
+static ast_node_t* create_string(parser_t* parser, token_t* token) {
+    uint32_t length;
+    const char* text = literal_string(&parser->ctx->token_stream.literals,
+        token, &length);
+    return create_ast_node_string(parser->arena, token, text, length);
+}
 
+static ast_node_t* parse_primary(parser_t* parser) {
     ast_node_t* node = NULL;
-    if (is_next_token(TOKEN_IDENT)) {
-        ast_node_t* ident = create_ast_node_ident(next_token());
+    if (is_next_token(parser, TOKEN_IDENT)) {
+        token_t token_ident = next_token(parser);
+        ast_node_t* ident = create_ident(parser, &token_ident);
 
-        check_use_before_decl(ident);
+        resolve_ident(parser, ident);
+        check_use_before_decl(parser, ident);
 
-        if (is_next_token(TOKEN_LEFT_PAREN)) {
-            node = parse_funccall(ident);
-        } else if (is_next_token(TOKEN_LEFT_BRACKET)) {
-            node = parse_arrayaccess(ident);
+        if (is_next_token(parser, TOKEN_LEFT_PAREN)) {
+            node = parse_funccall(parser, ident);
+        } else if (is_next_token(parser, TOKEN_LEFT_BRACKET)) {
+            node = parse_arrayaccess(parser, ident);
         } else {
             node = ident;
         }
-    } else if (is_next_token(TOKEN_NUMBER)) {
-        node = create_ast_node_number(next_token());
-    } else if (is_next_token(TOKEN_STRING)) {
-        node = create_ast_node_string(next_token());
-    } else if (is_next_token(TOKEN_CHARCONST)) {
-        node = create_ast_node_char(next_token());
-    } else if (is_next_token(TOKEN_LEFT_PAREN)) {
-        match(TOKEN_LEFT_PAREN);
-        node = parse_expr();
-        match(TOKEN_RIGHT_PAREN);
-    } else if (is_next_token(TOKEN_BANG)) {
-        token_t* token_op = next_token();
-        node = create_ast_node_unary(token_op, parse_factor());
+    } else if (is_next_token(parser, TOKEN_NUMBER)) {
+        token_t token = next_token(parser);
+        node = BUILD(parser, create_ast_node_number(parser->arena, &token));
+    } else if (is_next_token(parser, TOKEN_STRING)) {
+        token_t token = next_token(parser);
+        node = BUILD(parser, create_string(parser, &token));
+    } else if (is_next_token(parser, TOKEN_CHARCONST)) {
+        token_t token = next_token(parser);
+        node = BUILD(parser, create_ast_node_char(parser->arena, &token));
+    } else if (is_next_token(parser, TOKEN_LEFT_PAREN)) {
+        match(parser, TOKEN_LEFT_PAREN);
+        node = parse_expr(parser);
+        match(parser, TOKEN_RIGHT_PAREN);
     } else {
-        error_at(next_token(), "unexpected token");
-    }
-    return node;
-}
-
-static ast_node_t* parse_term() {
-    ast_node_t* node = parse_factor();
-
-    while (is_next_token_any(3, TOKEN_STAR, TOKEN_SLASH, TOKEN_AND)) {
-        token_t* token_op = next_token();
-        node = create_ast_node_binary(token_op, node, parse_factor());
+        error_at(parser, next_token(parser), "unexpected token");
     }
     return node;
 }
 
-static ast_node_t* parse_expr_simp() {
+// Parses an expression whose binary operators bind at least as tightly as
+// min_bp. A leading '-' or '+' applies to a whole multiplicative operand and
+// is only allowed where an additive operand could start, so "a * -b" is an
+// error as it has always been.
+static ast_node_t* parse_expr_bp(parser_t* parser, binding_power_t min_bp) {
     ast_node_t* node;
-
-    if (is_next_token(TOKEN_PLUS)) {
-        match(TOKEN_PLUS);
-    } else if  (is_next_token(TOKEN_MINUS)) {
-        token_t* token_op = next_token();
-        node = create_ast_node_unary(token_op, parse_term());
+    token_type_t type = peek_type(parser, 0);
+
+    if (type == TOKEN_BANG) {
+        token_t token_op = next_token(parser);
+        ast_node_t* expr = parse_expr_bp(parser, BP_UNARY);
+        node = BUILD(parser,
+            create_ast_node_unary(parser->arena, &token_op, expr));
+    } else if (type == TOKEN_MINUS && min_bp <= BP_ADDITIVE) {
+        token_t token_op = next_token(parser);
+        ast_node_t* expr = parse_expr_bp(parser, BP_MULTIPLICATIVE);
+        node = BUILD(parser,
+            create_ast_node_unary(parser->arena, &token_op, expr));
+    } else if (type == TOKEN_PLUS && min_bp <= BP_ADDITIVE) {
+        advance(parser);
+        node = parse_expr_bp(parser, BP_MULTIPLICATIVE);
     } else {
-        node = parse_term();
+        node = parse_primary(parser);
     }
 
-    while (is_next_token_any(3, TOKEN_PLUS, TOKEN_MINUS, TOKEN_OR)) {
-        token_t* token_op = next_token();
-        node = create_ast_node_binary(token_op, node, parse_term());
+    // All binary operators are left associative.
+    for (;;) {
+        binding_power_t bp = binary_power[peek_type(parser, 0)];
+        if (bp == BP_NONE || bp < min_bp)
+            break;
+        token_t token_op = next_token(parser);
+        ast_node_t* right = parse_expr_bp(parser, bp + 1);
+        node = BUILD(parser,
+            create_ast_node_binary(parser->arena, &token_op, node, right));
     }
     return node;
 }
 
-static ast_node_t* parse_expr() {
-    ast_node_t* node = parse_expr_simp();
-
-    while (is_next_token_any(3, TOKEN_EQUAL_EQUAL, TOKEN_BANG_EQUAL, TOKEN_LESS_EQUAL) ||
-        is_next_token_any(3, TOKEN_LESS, TOKEN_GREATER_EQUAL, TOKEN_GREATER)) {
-            token_t* token_op = next_token();
-            node = create_ast_node_binary(token_op, node, parse_expr_simp());
-    }
-    return node;
+static ast_node_t* parse_expr(parser_t* parser) {
+    return parse_expr_bp(parser, BP_COMPARISON);
 }
 
-static void parse_if_stmt(ast_node_t* parent) {
+static void parse_if_stmt(parser_t* parser) {
     ast_node_t* node = NULL;
-    match(TOKEN_IF);
-    token_t* token_if = last_token();
-
-    if (match(TOKEN_LEFT_PAREN)) {
-        node = create_ast_node_if(token_if, parse_expr());
-        match(TOKEN_RIGHT_PAREN);
-        parse_stmt(node->as.ifstmt._if);
-
-        if (is_next_token(TOKEN_ELSE)) {
-            match(TOKEN_ELSE);
-            parse_stmt(node->as.ifstmt._else);
+    match(parser, TOKEN_IF);
+    token_t token_if = last_token(parser);
+
+    if (match(parser, TOKEN_LEFT_PAREN)) {
+        ast_node_t* cond = parse_expr(parser);
+        node = BUILD(parser, create_ast_node_if(parser->arena, &token_if, cond));
+        match(parser, TOKEN_RIGHT_PAREN);
+        uint32_t base = begin_list(parser);
+        parse_stmt(parser);
+        end_list(parser, base, node->as.ifstmt._if);
+
+        if (is_next_token(parser, TOKEN_ELSE)) {
+            match(parser, TOKEN_ELSE);
+            base = begin_list(parser);
+            parse_stmt(parser);
+            end_list(parser, base, node->as.ifstmt._else);
         }
-        add_stmt(parent, node);
+        add_node(parser, node);
     }
 }
 
-static void parse_while_stmt(ast_node_t* parent) {
+static void parse_while_stmt(parser_t* parser) {
     ast_node_t* node = NULL;
-    match(TOKEN_WHILE);
-    token_t* token_while = last_token();
-
-    if (match(TOKEN_LEFT_PAREN)) {
-        node = create_ast_node_while(token_while, parse_expr());
-        match(TOKEN_RIGHT_PAREN);
-        parse_stmt(node->as.whilestmt.stmts);
-        add_stmt(parent, node);
+    match(parser, TOKEN_WHILE);
+    token_t token_while = last_token(parser);
+
+    if (match(parser, TOKEN_LEFT_PAREN)) {
+        ast_node_t* cond = parse_expr(parser);
+        node = BUILD(parser,
+            create_ast_node_while(parser->arena, &token_while, cond));
+        match(parser, TOKEN_RIGHT_PAREN);
+        uint32_t base = begin_list(parser);
+        parse_stmt(parser);
+        end_list(parser, base, node->as.whilestmt.stmts);
+        add_node(parser, node);
     }
 }
 
-static void parse_for_stmt(ast_node_t* parent) {
+static void parse_for_stmt(parser_t* parser) {
     ast_node_t* node = NULL;
     ast_node_t* init = NULL;
     ast_node_t* cond = NULL;
     ast_node_t* incr = NULL;
 
-    match(TOKEN_FOR);
-    token_t* token_for = last_token();
-    if (match(TOKEN_LEFT_PAREN)) {
+    match(parser, TOKEN_FOR);
+    token_t token_for = last_token(parser);
+    if (match(parser, TOKEN_LEFT_PAREN)) {
 
-        if (!is_next_token(TOKEN_SEMICOLON)) init = parse_assign();
-        match(TOKEN_SEMICOLON);
+        if (!is_next_token(parser, TOKEN_SEMICOLON)) init = parse_assign(parser);
+        match(parser, TOKEN_SEMICOLON);
 
-        if (!is_next_token(TOKEN_SEMICOLON)) cond = parse_expr();
-        match(TOKEN_SEMICOLON);
+        if (!is_next_token(parser, TOKEN_SEMICOLON)) cond = parse_expr(parser);
+        match(parser, TOKEN_SEMICOLON);
 
-        if (!is_next_token(TOKEN_RIGHT_PAREN)) incr = parse_assign();
-        match(TOKEN_RIGHT_PAREN);
+        if (!is_next_token(parser, TOKEN_RIGHT_PAREN)) incr = parse_assign(parser);
+        match(parser, TOKEN_RIGHT_PAREN);
 
-        node = create_ast_node_for(token_for, init, cond, incr);
-        parse_stmt(node->as.forstmt.stmts);
-        add_stmt(parent, node);
+        node = BUILD(parser,
+            create_ast_node_for(parser->arena, &token_for, init, cond, incr));
+        uint32_t base = begin_list(parser);
+        parse_stmt(parser);
+        end_list(parser, base, node->as.forstmt.stmts);
+        add_node(parser, node);
     }
 }
 
-static void parse_return_stmt(ast_node_t* parent) {
+static void parse_return_stmt(parser_t* parser) {
     ast_node_t* node = NULL;
-    match(TOKEN_RETURN);
-    token_t* token_return = last_token();
-
-    if (is_next_token(TOKEN_SEMICOLON)) {
-        match(TOKEN_SEMICOLON);
-        node = create_ast_node_return(token_return, NULL);
-        add_stmt(parent, node);
+    match(parser, TOKEN_RETURN);
+    token_t token_return = last_token(parser);
+
+    if (is_next_token(parser, TOKEN_SEMICOLON)) {
+        match(parser, TOKEN_SEMICOLON);
+        node = BUILD(parser,
+            create_ast_node_return(parser->arena, &token_return, NULL));
+        add_node(parser, node);
     } else {
-        node = create_ast_node_return(token_return, parse_expr());
-        match(TOKEN_SEMICOLON);
-        add_stmt(parent, node);
+        ast_node_t* expr = parse_expr(parser);
+        node = BUILD(parser,
+            create_ast_node_return(parser->arena, &token_return, expr));
+        match(parser, TOKEN_SEMICOLON);
+        add_node(parser, node);
     }
 }
 
-static void parse_brace_stmt(ast_node_t* parent) {
-    match(TOKEN_LEFT_BRACE);
-    while (
-        is_next_token_any(4, TOKEN_IF, TOKEN_WHILE, TOKEN_FOR, TOKEN_RETURN) ||
-        is_next_token_any(3, TOKEN_IDENT, TOKEN_LEFT_BRACE, TOKEN_SEMICOLON)) {
-            parse_stmt(parent);
-    }
-    match(TOKEN_RIGHT_BRACE);
+static void parse_brace_stmt(parser_t* parser) {
+    match(parser, TOKEN_LEFT_BRACE);
+    while (is_next_token_in(parser, STMT_SET))
+        parse_stmt(parser);
+    match(parser, TOKEN_RIGHT_BRACE);
 }
 
-static void parse_ident_stmt(ast_node_t* parent) {
-    if (peek(1)->type == TOKEN_LEFT_PAREN) {
-        match(TOKEN_IDENT);
-        token_t* token_ident = last_token();
-        ast_node_t* node = parse_funccall(create_ast_node_ident(token_ident));
-        add_stmt(parent, node);
+static void parse_ident_stmt(parser_t* parser) {
+    if (peek_type(parser, 1) == TOKEN_LEFT_PAREN) {
+        match(parser, TOKEN_IDENT);
+        token_t token_ident = last_token(parser);
+        ast_node_t* ident = create_ident(parser, &token_ident);
+        resolve_ident(parser, ident);
+        ast_node_t* node = parse_funccall(parser, ident);
+        add_node(parser, node);
     } else {
-        add_stmt(parent, parse_assign());
-        match(TOKEN_SEMICOLON);
+        add_node(parser, parse_assign(parser));
+        match(parser, TOKEN_SEMICOLON);
     }
 }
 
-static void parse_stmt(ast_node_t* parent) {
-    if (parser.panic_mode)
-        synchronize();
-
-    if (is_next_token(TOKEN_IF)) {
-        parse_if_stmt(parent);
-
-    } else if (is_next_token(TOKEN_WHILE)) {
-        parse_while_stmt(parent);
-
-    } else if (is_next_token(TOKEN_FOR)) {
-        parse_for_stmt(parent);
-
-    } else if (is_next_token(TOKEN_RETURN)) {
-        parse_return_stmt(parent);
-
-    } else if (is_next_token(TOKEN_LEFT_BRACE)) {
-        parse_brace_stmt(parent);
-
-    } else if (is_next_token(TOKEN_IDENT)) {
-        parse_ident_stmt(parent);
+static void parse_empty_stmt(parser_t* parser) {
+    match(parser, TOKEN_SEMICOLON);
+}
 
-    } else if (is_next_token(TOKEN_SEMICOLON)) {
-        match(TOKEN_SEMICOLON);
-    } else {
-        error_at(next_token(), "unexpected token");
-    }
+typedef void (*parse_fn_t)(parser_t* parser);
+
+// The parser for each token a statement can start with, see STMT_SET.
+static const parse_fn_t stmt_parsers[TOKEN_EOF + 1] = {
+    [TOKEN_IF] = parse_if_stmt,
+    [TOKEN_WHILE] = parse_while_stmt,
+    [TOKEN_FOR] = parse_for_stmt,
+    [TOKEN_RETURN] = parse_return_stmt,
+    [TOKEN_LEFT_BRACE] = parse_brace_stmt,
+    [TOKEN_IDENT] = parse_ident_stmt,
+    [TOKEN_SEMICOLON] = parse_empty_stmt,
+};
+
+static void parse_stmt(parser_t* parser) {
+    if (parser->panic_mode)
+        synchronize(parser);
+
+    parse_fn_t parse_fn = stmt_parsers[peek_type(parser, 0)];
+    if (parse_fn != NULL)
+        parse_fn(parser);
+    else
+        error_at(parser, next_token(parser), "unexpected token");
 }
 
-static void parse_vardecls_for_func(ast_node_t* func_node, ast_node_t* parent) {
-    if (is_next_token_any(2, TOKEN_INT, TOKEN_CHAR)) {
-        token_t* token_type = next_token();
-        token_type_t type = tokentype_2_decltype(token_type->type);
-        if (match(TOKEN_IDENT)) {
-            ast_node_t* ident = create_ast_node_ident(last_token());
+static void parse_vardecls_for_func(parser_t* parser) {
+    if (is_next_token_in(parser, TYPE_SET)) {
+        token_t token_type = next_token(parser);
+        token_type_t type = tokentype_2_decltype(token_type.type);
+        if (match(parser, TOKEN_IDENT)) {
+            token_t token_ident = last_token(parser);
+            ast_node_t* ident = create_ident(parser, &token_ident);
             bool is_array = false;
             int array_size = 0;
-            if (is_next_token(TOKEN_LEFT_BRACKET)) {
-                match(TOKEN_LEFT_BRACKET);
+            if (is_next_token(parser, TOKEN_LEFT_BRACKET)) {
+                match(parser, TOKEN_LEFT_BRACKET);
                 is_array = true;
-                if (match(TOKEN_NUMBER)) {
-                    char* s = lexeme(last_token());
-                    array_size = atoi(s);
-                    free(s);
-                }
-                match(TOKEN_RIGHT_BRACKET);
+                if (match(parser, TOKEN_NUMBER))
+                    array_size = (int)last_token(parser).value;
+                match(parser, TOKEN_RIGHT_BRACKET);
             }
+            if (parser->recognize_only)
+                return;
             ast_node_t* node = create_ast_node_vardecl(
-                type, ident, is_array, array_size);
-
-            sym_entry_t* entry = sym_lookup(parser.global_sym_table,
-                func_node->as.funcdecl.ident->as.ident.value);
+                parser->arena, type, ident, is_array, array_size);
 
-
-            if (!insert_sym_from_vardecl_node(entry->as.func.sym_table, node)) {
-                parser.had_error = true;
+            sym_scope_t* scope = parser->cur_func != NULL ?
+                &parser->cur_func->as.func.scope : NULL;
+            if (!insert_sym_from_vardecl_node(parser->ctx, parser->sym_table,
+                scope, node)) {
+                parser->had_error = true;
             }
 
-            add_stmt(parent, node);
+            add_node(parser, node);
         }
     }
 }
 
-static void begin_parse_vardecls_for_func(
-    ast_node_t* func_node, ast_node_t* parent) {
+static void begin_parse_vardecls_for_func(parser_t* parser) {
 
-    parse_vardecls_for_func(func_node, parent);
-    while (is_next_token(TOKEN_COMMA)) {
-        advance();
-        parse_vardecls_for_func(func_node, parent);
+    parse_vardecls_for_func(parser);
+    while (is_next_token(parser, TOKEN_COMMA)) {
+        advance(parser);
+        parse_vardecls_for_func(parser);
     }
-    match(TOKEN_SEMICOLON);
+    match(parser, TOKEN_SEMICOLON);
 }
 
-static ast_node_t* parse_param() {
+static ast_node_t* parse_param(parser_t* parser) {
     ast_node_t* node = NULL;
-    token_t* token_type;
-    token_t* token_ident;
+    token_t token_type;
+    token_t token_ident;
     bool is_array = false;
 
-    if (is_next_token_any(2, TOKEN_INT, TOKEN_CHAR)) {
-        token_type = next_token();
-        if (match(TOKEN_IDENT)) {
-            token_ident = last_token();
-            ast_node_t* ident = create_ast_node_ident(token_ident);
-            decl_type_t argtype = tokentype_2_decltype(token_type->type);
-            if (is_next_token(TOKEN_LEFT_BRACKET)) {
-                match(TOKEN_LEFT_BRACKET);
+    if (is_next_token_in(parser, TYPE_SET)) {
+        token_type = next_token(parser);
+        if (match(parser, TOKEN_IDENT)) {
+            token_ident = last_token(parser);
+            ast_node_t* ident = create_ident(parser, &token_ident);
+            decl_type_t argtype = tokentype_2_decltype(token_type.type);
+            if (is_next_token(parser, TOKEN_LEFT_BRACKET)) {
+                match(parser, TOKEN_LEFT_BRACKET);
                 is_array = true;
-                match(TOKEN_RIGHT_BRACKET);
+                match(parser, TOKEN_RIGHT_BRACKET);
             }
-            node = create_ast_node_paramdecl(argtype, ident, is_array);
+            node = create_ast_node_paramdecl(parser->arena, argtype, ident, is_array);
         }
-    } else if (is_next_token(TOKEN_VOID)) {
-        next_token();
+    } else if (is_next_token(parser, TOKEN_VOID)) {
+        next_token(parser);
     } else {
-        error_at(next_token(), "expected 'int', 'char' or 'void'");
+        error_at(parser, next_token(parser), "expected 'int', 'char' or 'void'");
     }
     return node;
 }
 
-static ast_node_t* parse_params() {
-    ast_node_t* node = create_ast_node_paramdecl_list();
-    ast_node_t* param = parse_param();
+static ast_node_t* parse_params(parser_t* parser) {
+    ast_node_t* node = create_ast_node_paramdecl_list(parser->arena);
+    uint32_t base = begin_list(parser);
+    ast_node_t* param = parse_param(parser);
     if (param != NULL) {
-        add_paramdecl(node, param);
-        while (is_next_token(TOKEN_COMMA)) {
-            match(TOKEN_COMMA);
-            add_paramdecl(node, parse_param());
+        add_node(parser, param);
+        while (is_next_token(parser, TOKEN_COMMA)) {
+            match(parser, TOKEN_COMMA);
+            add_node(parser, parse_param(parser));
         }
     }
+    end_list(parser, base, node);
     return node;
 }
 
-static ast_node_t* parse_funcdecl(ast_node_t* parent, token_t* token_type) {
-    if (match(TOKEN_IDENT)) {
-        token_t* token_ident = last_token();
-        match(TOKEN_LEFT_PAREN);
+static ast_node_t* parse_funcdecl(parser_t* parser, token_t* token_type) {
+    if (match(parser, TOKEN_IDENT)) {
+        token_t token_ident = last_token(parser);
+        match(parser, TOKEN_LEFT_PAREN);
         token_type_t type = tokentype_2_decltype(token_type->type);
-        ast_node_t* ident = create_ast_node_ident(token_ident);
-        ast_node_t* params = parse_params();
-        ast_node_t* node = create_ast_node_funcdecl(type, ident);
+        ast_node_t* ident = create_ident(parser, &token_ident);
+        ast_node_t* params = parse_params(parser);
+        ast_node_t* node = create_ast_node_funcdecl(parser->arena, type, ident);
         node->as.funcdecl.params = params;
-        match(TOKEN_RIGHT_PAREN);
-        add_stmt(parent, node);
+        match(parser, TOKEN_RIGHT_PAREN);
+        add_node(parser, node);
 
         return node;
         // TODO: add symbol
@@ -509,147 +646,426 @@ static ast_node_t* parse_funcdecl(ast_node_t* parent, token_t* token_type) {
     return NULL; // TODO: return a func anyway?
 }
 
-static void set_sym_scope_to_func(ast_node_t* node) {
-    sym_entry_t* entry = sym_lookup(parser.global_sym_table,
-            node->as.funcdecl.ident->as.ident.value);
+static void parse_func_body(parser_t* parser, ast_node_t* node) {
+    ast_node_t* ident = node->as.funcdecl.ident;
+    sym_entry_t* entry = sym_lookup(parser->sym_table, ident->as.ident.atom);
+    ident->as.ident.entry = entry;
+    // The locals of a body under a name that is not a function are kept
+    // nowhere.
+    parser->cur_func = entry != NULL && entry->type == SYM_FUNC ? entry : NULL;
+    open_scope(parser->sym_table);
+    if (parser->cur_func != NULL)
+        bind_scope(parser->sym_table, &parser->cur_func->as.func.scope);
+    parser->recognize_only = parser->syntax_only;
+
+    match(parser, TOKEN_LEFT_BRACE);
+
+    uint32_t base = begin_list(parser);
+    while (is_next_token_in(parser, TYPE_SET)) {
+        begin_parse_vardecls_for_func(parser);
+    }
 
-    parser.cur_sym_table = entry->as.func.sym_table;
-}
+    while (!is_next_token(parser, TOKEN_RIGHT_BRACE) &&
+        !is_next_token(parser, TOKEN_EOF)) {
+        parse_stmt(parser);
+    }
+    end_list(parser, base, node->as.funcdecl.stmts);
+    parser->recognize_only = false;
 
-// Do not allow any var for this symbol anymore.
-static void lock_sym_table(ast_node_t* node) {
-    sym_entry_t* entry = sym_lookup(parser.global_sym_table,
-            node->as.funcdecl.ident->as.ident.value);
-    entry->as.func.sym_table->accepts_new_var = false;
-}
+    // Do not allow any var for this function anymore.
+    if (parser->cur_func != NULL)
+        parser->cur_func->as.func.scope.accepts_new_var = false;
+    close_scope(parser->sym_table);
+    parser->cur_func = NULL;
 
-static void begin_parse_funcdecl(ast_node_t* parent, token_t* token_type) {
-    if (parser.panic_mode) return;
-    ast_node_t* node = parse_funcdecl(parent, token_type);
-    if (node == NULL)
-        return;
+    match(parser, TOKEN_RIGHT_BRACE);
+}
 
-    if (is_next_token(TOKEN_COMMA)) {
-        if (!insert_sym_from_funcdecl_prototype_node(parser.global_sym_table, node)) {
-            parser.had_error = true;
+// Skips the body of node up to the matching '}' and queues it.
+static void defer_func_body(parser_t* parser, ast_node_t* node) {
+    uint32_t begin = parser->cur_position;
+    uint32_t depth = 0;
+    for (;;) {
+        token_type_t type = peek_type(parser, 0);
+        if (type == TOKEN_EOF) {
+            error_at(parser, next_token(parser), "expected '}'");
+            return;
         }
-        while (match(TOKEN_COMMA)) {
-            node = parse_funcdecl(parent, token_type);
-            if (!insert_sym_from_funcdecl_prototype_node(parser.global_sym_table, node)) {
-                parser.had_error = true;
-            }
+        if (type == TOKEN_LEFT_BRACE) {
+            depth++;
+        } else if (type == TOKEN_RIGHT_BRACE) {
+            if (--depth == 0)
+                break;
+        } else if (type == TOKEN_IDENT && parser->intern_deferred) {
+            token_t token = token_at(parser, parser->cur_position);
+            intern(&parser->ctx->interner, token.start, token.length);
         }
-        match(TOKEN_SEMICOLON);
-    } else if (is_next_token(TOKEN_LEFT_BRACE)) {
-        if (!insert_sym_from_funcdef_node(parser.global_sym_table, node)) {
-            parser.had_error = true;
+        advance(parser);
+    }
+
+    if (parser->deferred_count == parser->deferred_capacity) {
+        parser->deferred_capacity = parser->deferred_capacity < 64 ?
+            64 : parser->deferred_capacity * 2;
+        parser->deferred = realloc(parser->deferred,
+            parser->deferred_capacity * sizeof(deferred_body_t));
+        if (parser->deferred == NULL) {
+            fprintf(stderr, "Could not allocate memory for deferred bodies\n");
+            exit(EXIT_FAILURE);
         }
+    }
+    deferred_body_t* body = &parser->deferred[parser->deferred_count++];
+    body->func = node;
+    body->begin = begin;
+    body->end = parser->cur_position;
+    node->as.funcdecl.deferred_body = parser->deferred_count;
+
+    // The closing brace.
+    advance(parser);
+}
 
-        set_sym_scope_to_func(node);
+static void parse_deferred_body(parser_t* parser, deferred_body_t* body) {
+    body->func->as.funcdecl.deferred_body = 0;
+    parser->cur_position = body->begin;
+    parser->panic_mode = false;
+    parse_func_body(parser, body->func);
+}
 
-        match(TOKEN_LEFT_BRACE);
+static void begin_parse_funcdecl(parser_t* parser, token_t* token_type) {
+    if (parser->panic_mode) return;
+    ast_node_t* node = parse_funcdecl(parser, token_type);
+    if (node == NULL)
+        return;
 
-        while (is_next_token_any(2, TOKEN_INT, TOKEN_CHAR)) {
-            begin_parse_vardecls_for_func(node, node->as.funcdecl.stmts);
+    if (is_next_token(parser, TOKEN_COMMA)) {
+        if (!insert_sym_from_funcdecl_prototype_node(parser->ctx,
+                parser->sym_table, node)) {
+            parser->had_error = true;
         }
-
-        while (!is_next_token(TOKEN_RIGHT_BRACE) && !is_next_token(TOKEN_EOF)) {
-            parse_stmt(node->as.funcdecl.stmts);
+        while (match(parser, TOKEN_COMMA)) {
+            node = parse_funcdecl(parser, token_type);
+            if (!insert_sym_from_funcdecl_prototype_node(parser->ctx,
+                parser->sym_table, node)) {
+                parser->had_error = true;
+            }
+        }
+        match(parser, TOKEN_SEMICOLON);
+    } else if (is_next_token(parser, TOKEN_LEFT_BRACE)) {
+        if (!insert_sym_from_funcdef_node(parser->ctx,
+                parser->sym_table, node)) {
+            parser->had_error = true;
         }
 
-        lock_sym_table(node);
-
-        match(TOKEN_RIGHT_BRACE);
-    } else if (is_next_token(TOKEN_SEMICOLON)) {
-        if (!insert_sym_from_funcdecl_prototype_node(parser.global_sym_table, node)) {
-            parser.had_error = true;
+        if (parser->defer_bodies)
+            defer_func_body(parser, node);
+        else
+            parse_func_body(parser, node);
+    } else if (is_next_token(parser, TOKEN_SEMICOLON)) {
+        if (!insert_sym_from_funcdecl_prototype_node(parser->ctx,
+                parser->sym_table, node)) {
+            parser->had_error = true;
         }
-        match(TOKEN_SEMICOLON);
+        match(parser, TOKEN_SEMICOLON);
     } else {
-        error_at(next_token(), "expected ';' or '{'");
+        error_at(parser, next_token(parser), "expected ';' or '{'");
     }
 }
 
-static void parse_vardecls(ast_node_t* parent, token_t* token_type) {
-    if (parser.panic_mode) return;
+static void parse_vardecls(parser_t* parser, token_t* token_type) {
+    if (parser->panic_mode) return;
     token_type_t type = tokentype_2_decltype(token_type->type);
 
-    if (is_next_token(TOKEN_IDENT)) {
-        ast_node_t* ident = create_ast_node_ident(next_token());
+    if (is_next_token(parser, TOKEN_IDENT)) {
+        token_t token_ident = next_token(parser);
+        ast_node_t* ident = create_ident(parser, &token_ident);
         int array_size = 0;
         bool is_array = false;
 
-        if (is_next_token(TOKEN_LEFT_BRACKET)) {
-            match(TOKEN_LEFT_BRACKET);
-            if (match(TOKEN_NUMBER)) {
-                char* s = lexeme(last_token());
-                array_size = atoi(s);
-                free(s);
-            }
-            match(TOKEN_RIGHT_BRACKET);
+        if (is_next_token(parser, TOKEN_LEFT_BRACKET)) {
+            match(parser, TOKEN_LEFT_BRACKET);
+            if (match(parser, TOKEN_NUMBER))
+                array_size = (int)last_token(parser).value;
+            match(parser, TOKEN_RIGHT_BRACKET);
         }
         ast_node_t* node = create_ast_node_vardecl(
-            type, ident, is_array, array_size);
+            parser->arena, type, ident, is_array, array_size);
 
-        add_stmt(parent, node);
-        if (!insert_sym_from_vardecl_node(parser.global_sym_table, node)) {
-            parser.had_error = true;
+        add_node(parser, node);
+        if (!insert_sym_from_vardecl_node(parser->ctx, parser->sym_table,
+                &parser->sym_table->globals, node)) {
+            parser->had_error = true;
         }
     }
 }
 
-static void begin_parse_vardecls(ast_node_t* parent, token_t* token_type) {
-    if (parser.panic_mode) return;
+static void begin_parse_vardecls(parser_t* parser, token_t* token_type) {
+    if (parser->panic_mode) return;
 
-    parse_vardecls(parent, token_type);
-    while (is_next_token(TOKEN_COMMA)) {
-        match(TOKEN_COMMA);
-        parse_vardecls(parent, token_type);
+    parse_vardecls(parser, token_type);
+    while (is_next_token(parser, TOKEN_COMMA)) {
+        match(parser, TOKEN_COMMA);
+        parse_vardecls(parser, token_type);
     }
-    match(TOKEN_SEMICOLON);
+    match(parser, TOKEN_SEMICOLON);
 }
 
-static void parse_func_or_decl(ast_node_t* parent) {
-    token_t* token_type;
+// A function or variables of type int or char.
+static void parse_typed_decl(parser_t* parser) {
+    token_t token_type = next_token(parser);
+    if (is_next_token(parser, TOKEN_IDENT)) {
+        if (peek_type(parser, 1) == TOKEN_LEFT_PAREN)
+            begin_parse_funcdecl(parser, &token_type);
+        else
+            begin_parse_vardecls(parser, &token_type);
+    } else {
+        error_at(parser, next_token(parser), "expected 'identifier'");
+    }
+}
 
-    if (parser.panic_mode)
-        synchronize_global();
+static void parse_void_funcdecl(parser_t* parser) {
+    token_t token_type = next_token(parser);
+    begin_parse_funcdecl(parser, &token_type);
+}
 
-    if (is_next_token_any(2, TOKEN_INT, TOKEN_CHAR)) {
-        token_type = next_token();
-        if (is_next_token(TOKEN_IDENT)) {
-            if (peek(1)->type == TOKEN_LEFT_PAREN)
-                begin_parse_funcdecl(parent, token_type);
-            else
-                begin_parse_vardecls(parent, token_type);
-        } else {
-            error_at(next_token(), "expected 'identifier'");
-        }
-    } else if (is_next_token(TOKEN_VOID)) {
-        token_type = next_token();
-        begin_parse_funcdecl(parent, token_type);
-    } else {
-        if (!is_next_token(TOKEN_EOF))
-            error_at(next_token(), "expected 'int' or 'char' or 'void'");
+// The parser for each token a global declaration can start with, see
+// DECL_SET.
+static const parse_fn_t decl_parsers[TOKEN_EOF + 1] = {
+    [TOKEN_INT] = parse_typed_decl,
+    [TOKEN_CHAR] = parse_typed_decl,
+    [TOKEN_VOID] = parse_void_funcdecl,
+};
+
+static void parse_func_or_decl(parser_t* parser) {
+    if (parser->panic_mode)
+        synchronize_global(parser);
+
+    parse_fn_t parse_fn = decl_parsers[peek_type(parser, 0)];
+    if (parse_fn != NULL)
+        parse_fn(parser);
+    else if (!is_next_token(parser, TOKEN_EOF))
+        error_at(parser, next_token(parser), "expected 'int' or 'char' or 'void'");
+}
+
+static void init_parser(compiler_ctx_t* ctx, parser_t* parser) {
+    parser->ctx = ctx;
+    parser->arena = &ctx->arena;
+    parser->cur_position = 0;
+    parser->token_stream = NULL;
+    parser->scanned = 0;
+    parser->last_string = 0;
+    parser->panic_mode = NULL;
+    parser->had_error = false;
+    parser->nodes.count = 0;
+    parser->sym_table = NULL;
+    parser->cur_func = NULL;
+    parser->defer_bodies = false;
+    parser->intern_deferred = false;
+    parser->atoms_interned = false;
+    parser->syntax_only = false;
+    parser->recognize_only = false;
+    free(parser->deferred);
+    parser->deferred = NULL;
+    parser->deferred_count = 0;
+    parser->deferred_capacity = 0;
+}
+
+static parser_t* do_parse(parser_t* parser) {
+    parser->sym_table = create_sym_table();
+    parser->ast = create_ast_node_root(parser->arena);
+
+    uint32_t base = begin_list(parser);
+    while (!is_next_token(parser, TOKEN_EOF)) {
+        parse_func_or_decl(parser);
     }
+    end_list(parser, base, parser->ast->as.root.stmts);
+    return parser;
 }
 
-static void init_parser() {
-    parser.cur_position = 0;
-    parser.token_stream = NULL;
-    parser.panic_mode = NULL;
-    parser.had_error = false;
-    parser.global_sym_table = create_sym_table(NULL);
-    parser.cur_sym_table = NULL;
+// The function bodies queued by the top level parser, taken in turn by the
+// workers of parse_deferred_bodies().
+typedef struct {
+    parser_t* parser;
+    atomic_uint next_body;
+    atomic_bool failed;
+} body_queue_t;
+
+// A worker parses with its own context: its own arena and error stream,
+// the rest shared with the top level context and only read.
+typedef struct {
+    body_queue_t* queue;
+    compiler_ctx_t ctx;
+    char* err;
+    size_t err_size;
+} body_worker_t;
+
+static void init_body_worker(body_worker_t* worker, body_queue_t* queue) {
+    compiler_ctx_t* ctx = queue->parser->ctx;
+    memset(worker, 0, sizeof(body_worker_t));
+    worker->queue = queue;
+    worker->ctx.out = ctx->out;
+    worker->ctx.err = open_memstream(&worker->err, &worker->err_size);
+    worker->ctx.line_index = ctx->line_index;
+    worker->ctx.interner = ctx->interner;
+    worker->ctx.token_stream = *queue->parser->token_stream;
+
+    parser_t* parser = &worker->ctx.parser;
+    init_parser(&worker->ctx, parser);
+    parser->token_stream = &worker->ctx.token_stream;
+    parser->sym_table = fork_sym_table(queue->parser->sym_table);
+    parser->atoms_interned = true;
 }
 
-parser_t* parse(char *buffer) {
-    init_parser();
-    parser.token_stream = get_tokens(buffer);
-    parser.ast = create_ast_node_root();
+static void* body_worker(void* arg) {
+    body_worker_t* worker = arg;
+    body_queue_t* queue = worker->queue;
+    parser_t* parser = &worker->ctx.parser;
+
+    while (!atomic_load(&queue->failed)) {
+        uint32_t k = atomic_fetch_add(&queue->next_body, 1);
+        if (k >= queue->parser->deferred_count)
+            break;
+        deferred_body_t* body = &queue->parser->deferred[k];
+        parse_deferred_body(parser, body);
+        // A body with errors may run past its '}', up to the EOF at worst.
+        if (parser->had_error || parser->cur_position != body->end + 1)
+            atomic_store(&queue->failed, true);
+    }
+    return NULL;
+}
+
+// Parses the queued bodies on up to jobs threads. The symbol table of each
+// function is only written by the worker parsing its body, the global one
+// is only read. Returns false if any body had an error.
+static bool parse_deferred_bodies(parser_t* parser, uint32_t jobs) {
+    if (parser->deferred_count < jobs)
+        jobs = parser->deferred_count;
+    if (jobs == 0)
+        return true;
 
-    while (!is_next_token(TOKEN_EOF)) {
-        parse_func_or_decl(parser.ast->as.root.stmts);
+    body_queue_t queue;
+    queue.parser = parser;
+    atomic_init(&queue.next_body, 0);
+    atomic_init(&queue.failed, false);
+
+    body_worker_t* workers = calloc(jobs, sizeof(body_worker_t));
+    pthread_t* threads = calloc(jobs, sizeof(pthread_t));
+    if (workers == NULL || threads == NULL) {
+        fprintf(stderr, "Could not allocate memory for parse workers\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < jobs; i++)
+        init_body_worker(&workers[i], &queue);
+
+    uint32_t started = 1;
+    for (; started < jobs; started++) {
+        if (pthread_create(&threads[started], NULL, body_worker,
+                &workers[started]) != 0)
+            break;
+    }
+    body_worker(&workers[0]);
+    for (uint32_t i = 1; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    // The bodies' nodes go with the context's arena.
+    for (uint32_t i = 0; i < jobs; i++) {
+        adopt_arena(parser->arena, &workers[i].ctx.arena);
+        join_sym_table(parser->sym_table, workers[i].ctx.parser.sym_table);
+        free_ast_node_stack(&workers[i].ctx.parser.nodes);
+        // A worker reporting an error builds its own line index.
+        if (workers[i].ctx.line_index.starts != parser->ctx->line_index.starts)
+            free_line_index(&workers[i].ctx.line_index);
+        fclose(workers[i].ctx.err);
+        free(workers[i].err);
     }
-    return &parser;
+    free(threads);
+    free(workers);
+    return !atomic_load(&queue.failed);
+}
+
+// Parses everything but the function bodies, then the bodies on jobs
+// threads. Nothing is reported: on any error it all is dropped and false is
+// returned, for the serial parse to report the errors in order.
+static bool parse_parallel(compiler_ctx_t* ctx, token_stream_t* token_stream,
+    uint32_t jobs) {
+    parser_t* parser = &ctx->parser;
+    init_parser(ctx, parser);
+    parser->token_stream = token_stream;
+    parser->defer_bodies = true;
+    parser->intern_deferred = true;
+
+    FILE* err = ctx->err;
+    char* err_buffer = NULL;
+    size_t err_size = 0;
+    ctx->err = open_memstream(&err_buffer, &err_size);
+    do_parse(parser);
+    bool ok = !parser->had_error && parse_deferred_bodies(parser, jobs);
+    fclose(ctx->err);
+    free(err_buffer);
+    ctx->err = err;
+
+    free(parser->deferred);
+    parser->deferred = NULL;
+    parser->deferred_count = 0;
+    parser->deferred_capacity = 0;
+    parser->defer_bodies = false;
+    parser->intern_deferred = false;
+
+    if (!ok) {
+        // The names go with the nodes.
+        free_sym_table(parser->sym_table);
+        parser->sym_table = NULL;
+        free_arena(&ctx->arena);
+        reset_interner(&ctx->interner);
+    }
+    return ok;
+}
+
+// With jobs above 1 the function bodies are parsed in parallel, falling
+// back to a serial parse when the source has errors.
+parser_t* parse(compiler_ctx_t* ctx, token_stream_t* token_stream,
+    uint32_t jobs) {
+    parser_t* parser = &ctx->parser;
+    if (jobs > 1 && parse_parallel(ctx, token_stream, jobs))
+        return parser;
+    init_parser(ctx, parser);
+    parser->token_stream = token_stream;
+    return do_parse(parser);
+}
+
+// Parses the global declarations and the function signatures, skipping the
+// bodies until parse_function_body() asks for them.
+parser_t* parse_declarations(compiler_ctx_t* ctx, token_stream_t* token_stream) {
+    parser_t* parser = &ctx->parser;
+    init_parser(ctx, parser);
+    parser->token_stream = token_stream;
+    parser->defer_bodies = true;
+    return do_parse(parser);
+}
+
+// Parses the body of func if parse_declarations() skipped it. Bodies are
+// best asked for in source order, errors are then reported in order.
+void parse_function_body(parser_t* parser, ast_node_t* func) {
+    uint32_t index = func->as.funcdecl.deferred_body;
+    if (index != 0)
+        parse_deferred_body(parser, &parser->deferred[index - 1]);
+}
+
+// Recognizes the source while scanning it on demand. Declarations are
+// parsed and checked against the global symbol table as usual, function
+// bodies are only checked for syntax: no node, list or name is made for
+// them.
+parser_t* check_syntax(compiler_ctx_t* ctx, const char* source) {
+    parser_t* parser = &ctx->parser;
+    init_parser(ctx, parser);
+    parser->syntax_only = true;
+    open_token_source(ctx, source, true);
+    return do_parse(parser);
+}
+
+// Parses without materializing the token stream: tokens are scanned on
+// demand, so token memory does not depend on the size of the source.
+parser_t* parse_streaming(compiler_ctx_t* ctx, const char* source) {
+    parser_t* parser = &ctx->parser;
+    init_parser(ctx, parser);
+    open_token_source(ctx, source, true);
+    return do_parse(parser);
 }
@@ -3,18 +3,65 @@
 
 #include "ast.h"
 #include "sym_table.h"
+#include "scanner.h"
 
+typedef struct compiler_ctx compiler_ctx_t;
 
+// A function body left for the workers of parse(), from its '{' to the
+// matching '}'.
 typedef struct {
+    ast_node_t* func;
+    uint32_t begin;
+    uint32_t end;
+} deferred_body_t;
+
+// Lookahead buffer used when streaming, must be a power of two.
+#define LOOKAHEAD_SIZE 4
+
+typedef struct {
+    compiler_ctx_t* ctx;
+    // Where the AST is allocated, the context's arena.
+    arena_t* arena;
     uint32_t cur_position;
+    // NULL when streaming, tokens are then kept in lookahead.
     token_stream_t* token_stream;
+    token_t lookahead[LOOKAHEAD_SIZE];
+    uint32_t scanned;
+    // Position of the last string token scanned while streaming. Strings
+    // are only read from lookahead, so the literal pool is emptied once
+    // the last one has left it.
+    uint32_t last_string;
     bool panic_mode;
     bool had_error;
-    sym_table_t* global_sym_table;
-    sym_table_t* cur_sym_table;
+    sym_table_t* sym_table;
+    // The function whose body is parsed, NULL if its name is not one.
+    sym_entry_t* cur_func;
     ast_node_t* ast;
+    // Children of the lists being parsed, see begin_list().
+    ast_node_stack_t nodes;
+    // Function bodies are skipped and queued in deferred, see parse() and
+    // parse_declarations().
+    bool defer_bodies;
+    // Names in the bodies are interned as they are skipped.
+    bool intern_deferred;
+    // Every name was interned beforehand, names are only looked up.
+    bool atoms_interned;
+    // Function bodies are only checked for syntax, see check_syntax().
+    bool syntax_only;
+    // Set while such a body is parsed: no node is built, placeholder is
+    // handed out instead and never looked at.
+    bool recognize_only;
+    ast_node_t placeholder;
+    deferred_body_t* deferred;
+    uint32_t deferred_count;
+    uint32_t deferred_capacity;
 } parser_t;
 
-parser_t* parse(char *buffer);
+parser_t* parse(compiler_ctx_t* ctx, token_stream_t* token_stream,
+    uint32_t jobs);
+parser_t* parse_streaming(compiler_ctx_t* ctx, const char* source);
+parser_t* parse_declarations(compiler_ctx_t* ctx, token_stream_t* token_stream);
+parser_t* check_syntax(compiler_ctx_t* ctx, const char* source);
+void parse_function_body(parser_t* parser, ast_node_t* func);
 
 #endif
\ No newline at end of file
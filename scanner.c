@@ -2,96 +2,168 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
-#include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "token.h"
 #include "scanner.h"
+#include "scanner_simd.h"
+#include "char_class.h"
+#include "line_index.h"
+#include "compiler_ctx.h"
+
+typedef struct {
+    const char* text;
+    uint32_t length;
+    token_type_t type;
+} keyword_t;
+
+// A slice of the source scanned by one worker in get_tokens_parallel().
+// Tokens starting in [begin, end) are kept, the last one may run past end.
+typedef struct {
+    uint32_t begin;
+    uint32_t end;
+    // Where the last kept token ends, begin when there is none.
+    uint32_t last_end;
+    token_stream_t tokens;
+    bool had_error;
+} lex_chunk_t;
+
+typedef struct {
+    const char* source;
+    lex_chunk_t* chunks;
+    uint32_t chunk_count;
+    atomic_uint next_chunk;
+} lex_job_t;
+
+static keyword_t keyword_table[KEYWORD_TABLE_SIZE];
+static uint32_t keyword_seed;
+static pthread_once_t keyword_table_once = PTHREAD_ONCE_INIT;
+
+// Token for bytes classified CHAR_SINGLE, CHAR_EQUAL_SUFFIX and CHAR_DOUBLE.
+// For CHAR_EQUAL_SUFFIX the two character form is the next token type.
+static const uint8_t char_token[256] = {
+    ['('] = TOKEN_LEFT_PAREN, [')'] = TOKEN_RIGHT_PAREN,
+    ['{'] = TOKEN_LEFT_BRACE, ['}'] = TOKEN_RIGHT_BRACE,
+    ['['] = TOKEN_LEFT_BRACKET, [']'] = TOKEN_RIGHT_BRACKET,
+    [';'] = TOKEN_SEMICOLON, [','] = TOKEN_COMMA,
+    ['-'] = TOKEN_MINUS, ['+'] = TOKEN_PLUS, ['*'] = TOKEN_STAR,
+    ['!'] = TOKEN_BANG, ['='] = TOKEN_EQUAL,
+    ['<'] = TOKEN_LESS, ['>'] = TOKEN_GREATER,
+    ['&'] = TOKEN_AND, ['|'] = TOKEN_OR,
+};
+
+
+static void* grow_array(void* array, size_t capacity, size_t item_size) {
+    array = realloc(array, capacity * item_size);
+    if (array == NULL) {
+        fprintf(stderr, "Could not allocate memory for token_stream\n");
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
 
-scanner_t scanner;
-token_stream_t token_stream;
-
-
-static void ensure_token_stream_capacity() {
-    if ((token_stream.count + 1) >= token_stream.capacity) {
-        size_t new_capacity =  token_stream.capacity + CAPACITY_STEP;
-
-        token_stream.tokens = realloc(token_stream.tokens,
-            new_capacity * sizeof(token_t));
-
-        if (token_stream.tokens == NULL) {
-            fprintf(stderr, "Could not allocate memory for token_stream\n");
-            exit(EXIT_FAILURE);
-        }
+static void ensure_token_stream_capacity(token_stream_t* token_stream) {
+    if (token_stream->count < token_stream->capacity)
+        return;
+
+    uint32_t new_capacity = token_stream->capacity < MIN_CAPACITY ?
+        MIN_CAPACITY : token_stream->capacity * 2;
+
+    token_stream->types = grow_array(token_stream->types,
+        new_capacity, sizeof(uint8_t));
+    token_stream->offsets = grow_array(token_stream->offsets,
+        new_capacity, sizeof(uint32_t));
+    token_stream->lengths = grow_array(token_stream->lengths,
+        new_capacity, sizeof(uint32_t));
+    token_stream->values = grow_array(token_stream->values,
+        new_capacity, sizeof(uint32_t));
+    token_stream->capacity = new_capacity;
+}
 
-        token_stream.capacity = new_capacity;
+// Reported at the start of the current token.
+static void report_error(scanner_t* scanner, const char* message) {
+    if (scanner->ctx != NULL) {
+        print_location(scanner->ctx->err, &scanner->ctx->line_index,
+            (uint32_t)(scanner->start - scanner->source));
+        fprintf(scanner->ctx->err, "%s\n", message);
     }
+    scanner->had_error = true;
 }
 
-static token_t* error_token(const char* message) {
-    ensure_token_stream_capacity();
-    token_t *token = &token_stream.tokens[token_stream.count];
-    token->type = TOKEN_ERROR;
-    token->start = message;
-    token->length = (uint32_t)strlen(message);
-    token->line = scanner.line;
-    fprintf(stderr, "Line: %d: %s\n", token->line, message);
-    token_stream.had_error = true;
+static token_t error_token(scanner_t* scanner, const char* message) {
+    token_t token;
+    report_error(scanner, message);
+    token.type = TOKEN_ERROR;
+    token.start = scanner->start;
+    token.length = 0;
+    token.offset = (uint32_t)(scanner->start - scanner->source);
+    token.value = 0;
     return token;
 }
 
-static token_t* make_token(token_type_t type) {
-    ensure_token_stream_capacity();
-    token_t *token = &token_stream.tokens[token_stream.count];
-    token->type = type;
-    token->start = scanner.start;
-    token->length = (uint32_t)(scanner.current - scanner.start);
-    token->line = scanner.line;
-    token_stream.count++;
+static void push_token(scanner_t* scanner, token_t* token) {
+    token_stream_t* token_stream = scanner->token_stream;
+    ensure_token_stream_capacity(token_stream);
+    token_stream->types[token_stream->count] = (uint8_t)token->type;
+    token_stream->offsets[token_stream->count] = token->offset;
+    token_stream->lengths[token_stream->count] = token->length;
+    token_stream->values[token_stream->count] = token->value;
+    token_stream->count++;
+}
+
+static token_t make_token(scanner_t* scanner, token_type_t type) {
+    token_t token;
+    token.type = type;
+    token.start = scanner->start;
+    token.length = (uint32_t)(scanner->current - scanner->start);
+    token.offset = (uint32_t)(scanner->start - scanner->source);
+    token.value = 0;
     return token;
 }
 
-static bool is_end() {
-    return *scanner.current == '\0';
+static bool is_end(scanner_t* scanner) {
+    return *scanner->current == '\0';
 }
 
-static bool match(char expected) {
-    if (is_end()) return false;
-    if (*scanner.current != expected) return false;
-    scanner.current++;
+static bool match(scanner_t* scanner, char expected) {
+    if (is_end(scanner)) return false;
+    if (*scanner->current != expected) return false;
+    scanner->current++;
     return true;
 }
 
-static char advance() {
-    scanner.current++;
-    return scanner.current[-1];
+static char advance(scanner_t* scanner) {
+    scanner->current++;
+    return scanner->current[-1];
 }
 
-static char peek() {
-    return *scanner.current;
+static char peek(scanner_t* scanner) {
+    return *scanner->current;
 }
 
-static char peek_next() {
-    if (is_end()) return '\0';
-    return scanner.current[1];
+static char peek_next(scanner_t* scanner) {
+    if (is_end(scanner)) return '\0';
+    return scanner->current[1];
 }
 
-static void skip_whitespace() {
+static void skip_whitespace(scanner_t* scanner) {
     for (;;) {
-        char c = peek();
-        switch (c) {
-            case ' ':
-            case '\r':
-            case '\t':
-                advance();
+        switch (CHAR_CLASS(peek(scanner))) {
+            case CHAR_BLANK:
+                advance(scanner);
+                // Single separating blanks are not worth a vector pass.
+                if (IS_BLANK(peek(scanner)))
+                    scanner->current = scanner_simd.span_blanks(scanner->current);
                 break;
 
-            case '\n':
-                scanner.line++;
-                advance();
+            case CHAR_NEWLINE:
+                advance(scanner);
                 break;
 
-            case '/':
-                if (peek_next() == '/') {
-                    while (peek() != '\n' && !is_end()) advance();
+            case CHAR_SLASH:
+                if (peek_next(scanner) == '/') {
+                    scanner->current =
+                        scanner_simd.find_line_end(scanner->current);
                 } else {
                     return;
                 }
@@ -103,155 +175,457 @@ static void skip_whitespace() {
     }
 }
 
-static void init_scanner(const char* source) {
-    scanner.start = source;
-    scanner.current = source;
-    scanner.line = 1;
+static uint32_t keyword_hash(const char* text, uint32_t length, uint32_t seed) {
+    return ((uint8_t)text[0] * seed + (uint8_t)text[length - 1] + length)
+        & (KEYWORD_TABLE_SIZE - 1);
+}
+
+static bool try_keyword_seed(uint32_t seed) {
+    static const keyword_t keywords[] = {
+#define KEYWORD_ENTRY(text, type) { text, sizeof(text) - 1, type },
+        KEYWORDS(KEYWORD_ENTRY)
+#undef KEYWORD_ENTRY
+    };
+
+    memset(keyword_table, 0, sizeof(keyword_table));
+    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+        uint32_t slot = keyword_hash(keywords[i].text, keywords[i].length, seed);
+        if (keyword_table[slot].text != NULL)
+            return false;
+        keyword_table[slot] = keywords[i];
+    }
+    return true;
+}
+
+// Searches for a seed that makes keyword_hash() collision free over the
+// KEYWORDS list, so a lookup is one hash, one length check and one memcmp.
+// Run once per process, the table is then only read.
+static void build_keyword_table() {
+    for (uint32_t seed = 1; seed < 256; seed++) {
+        if (try_keyword_seed(seed)) {
+            keyword_seed = seed;
+            return;
+        }
+    }
+    fprintf(stderr, "Could not build keyword table, "
+        "increase KEYWORD_TABLE_SIZE\n");
+    exit(EXIT_FAILURE);
+}
+
+static void init_keyword_table() {
+    pthread_once(&keyword_table_once, build_keyword_table);
 }
 
-static void init_token_stream() {
-    token_stream.count = 0;
-    token_stream.capacity = 0;
-    token_stream.tokens = NULL;
-    token_stream.had_error = false;
+// Offsets and diagnostics are relative to source, scanning starts at from.
+// Errors are reported through ctx, which is NULL when they are not.
+static void init_scanner(scanner_t* scanner, const char* source,
+    const char* from, token_stream_t* stream, compiler_ctx_t* ctx) {
+    init_keyword_table();
+    scanner->source = source;
+    scanner->start = from;
+    scanner->current = from;
+    scanner->token_stream = stream;
+    scanner->literals = NULL;
+    scanner->ctx = ctx;
+    scanner->had_error = false;
 }
 
-static token_t* character() {
-    if (peek() == '\\') {
-        advance();
+// Frees the arrays of a previous scan, if any.
+void free_token_stream(token_stream_t* token_stream) {
+    free(token_stream->types);
+    free(token_stream->offsets);
+    free(token_stream->lengths);
+    free(token_stream->values);
+    free(token_stream->literals.bytes);
+    memset(token_stream, 0, sizeof(token_stream_t));
+}
+
+static void init_token_stream(token_stream_t* token_stream,
+    const char* source, size_t size, uint32_t capacity) {
+    free_token_stream(token_stream);
+    if (capacity == 0)
+        capacity = (uint32_t)(size / BYTES_PER_TOKEN_ESTIMATE) + 1;
+
+    token_stream->count = 0;
+    token_stream->source = source;
+    token_stream->types = grow_array(NULL, capacity, sizeof(uint8_t));
+    token_stream->offsets = grow_array(NULL, capacity, sizeof(uint32_t));
+    token_stream->lengths = grow_array(NULL, capacity, sizeof(uint32_t));
+    token_stream->values = grow_array(NULL, capacity, sizeof(uint32_t));
+    token_stream->capacity = capacity;
+    token_stream->had_error = false;
+}
+
+// Returns the character c stands for after a backslash.
+static char decode_escape(scanner_t* scanner, char c) {
+    switch (c) {
+        case 'n':  return '\n';
+        case 't':  return '\t';
+        case '0':  return '\0';
+        case '\\': return '\\';
+        case '\'': return '\'';
+        case '"':  return '"';
+        default:
+            report_error(scanner, "Unknown escape sequence.");
+            return c;
     }
-    advance();
+}
 
-    if (peek() == '\'') {
-        advance();
-        token_t* token = make_token(TOKEN_CHARCONST);
-        token->start++;
-        token->length -= 2;
+static token_t character(scanner_t* scanner) {
+    char value = peek(scanner);
+    if (value == '\\') {
+        advance(scanner);
+        value = decode_escape(scanner, peek(scanner));
+    }
+    advance(scanner);
+
+    if (peek(scanner) == '\'') {
+        advance(scanner);
+        // The lexeme excludes the quotes.
+        token_t token = make_token(scanner, TOKEN_CHARCONST);
+        token.start++;
+        token.offset++;
+        token.length -= 2;
+        token.value = (uint8_t)value;
         return token;
     }
 
-    return error_token("Unclosed char.");
+    return error_token(scanner, "Unclosed char.");
 }
 
-static token_t* string() {
-    while (peek() != '"' && !is_end()) {
-        if (peek() == '\n')
-            scanner.line++;
-        advance();
+// Copies the text of the string being scanned to the literal pool with its
+// escapes decoded. Returns where it starts in the pool.
+static uint32_t decode_string(scanner_t* scanner, const char* text,
+    uint32_t length) {
+    literal_pool_t* literals = scanner->literals;
+    uint32_t needed = literals->size + sizeof(uint32_t) + length + 1;
+    if (needed > literals->capacity) {
+        uint32_t capacity = literals->capacity < MIN_CAPACITY ?
+            MIN_CAPACITY : literals->capacity;
+        while (capacity < needed)
+            capacity *= 2;
+        literals->bytes = grow_array(literals->bytes, capacity, sizeof(char));
+        literals->capacity = capacity;
     }
-    if (is_end())
-        return error_token("Unterminated string.");
 
-    // The closing quote.
-    advance();
-    token_t* token = make_token(TOKEN_STRING);
-    token->start++;
-    token->length -= 2;
+    uint32_t start = literals->size;
+    char* text_start = literals->bytes + start + sizeof(uint32_t);
+    char* dest = text_start;
+    for (uint32_t i = 0; i < length; i++) {
+        if (text[i] == '\\' && i + 1 < length)
+            *dest++ = decode_escape(scanner, text[++i]);
+        else
+            *dest++ = text[i];
+    }
+    *dest = '\0';
+
+    uint32_t decoded_length = (uint32_t)(dest - text_start);
+    memcpy(literals->bytes + start, &decoded_length, sizeof(uint32_t));
+    literals->size = (uint32_t)(dest + 1 - literals->bytes);
+    return start;
+}
 
+static token_t string(scanner_t* scanner) {
+    while (peek(scanner) != '"' && !is_end(scanner))
+        advance(scanner);
+    if (is_end(scanner))
+        return error_token(scanner, "Unterminated string.");
+
+    // The closing quote.
+    advance(scanner);
+    token_t token = make_token(scanner, TOKEN_STRING);
+    token.start++;
+    token.offset++;
+    token.length -= 2;
+    token.value = decode_string(scanner, token.start, token.length);
     return token;
 }
 
-static token_t* number() {
-    while (isdigit(peek())) advance();
-    return make_token(TOKEN_NUMBER);
+static token_t number(scanner_t* scanner) {
+    scanner->current = scanner_simd.span_digits(scanner->current);
+    token_t token = make_token(scanner, TOKEN_NUMBER);
+
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < token.length; i++) {
+        value = value * 10 + (uint32_t)(token.start[i] - '0');
+        if (value > MAX_NUMBER_VALUE) {
+            report_error(scanner, "Number too large.");
+            break;
+        }
+    }
+    token.value = (uint32_t)value;
+    return token;
 }
 
-static token_type_t check_keyword(int start, int length,
-    const char* rest, token_type_t type) {
-    if (scanner.current - scanner.start == start + length &&
-        memcmp(scanner.start + start, rest, length) == 0) {
-        return type;
+static token_type_t identifier_type(scanner_t* scanner) {
+    uint32_t length = (uint32_t)(scanner->current - scanner->start);
+    keyword_t* keyword = &keyword_table[
+        keyword_hash(scanner->start, length, keyword_seed)];
+
+    if (keyword->length == length &&
+        memcmp(scanner->start, keyword->text, length) == 0) {
+        return keyword->type;
     }
+    return TOKEN_IDENT;
+}
 
-  return TOKEN_IDENT;
+static token_t identifier(scanner_t* scanner) {
+    scanner->current = scanner_simd.span_alnum(scanner->current);
+    return make_token(scanner, identifier_type(scanner));
 }
 
-static token_type_t identifier_type() {
-    switch (scanner.start[0]) {
-        case 'c': return check_keyword(1, 3, "har", TOKEN_CHAR);
-        case 'e':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'l': return check_keyword(2, 2, "se", TOKEN_ELSE);
-                    case 'x': return check_keyword(2, 4, "tern", TOKEN_EXTERN);
-                }
-            }
+static token_t scan_token(scanner_t* scanner) {
+    skip_whitespace(scanner);
+    scanner->start = scanner->current;
+
+    char c = peek(scanner);
+    char_class_t class = CHAR_CLASS(c);
+    if (class == CHAR_END) return make_token(scanner, TOKEN_EOF);
+    advance(scanner);
+
+    token_type_t type = char_token[(uint8_t)c];
+
+    switch (class) {
+        case CHAR_ALPHA: return identifier(scanner);
+        case CHAR_DIGIT: return number(scanner);
+        case CHAR_SINGLE: return make_token(scanner, type);
+        case CHAR_SLASH: return make_token(scanner, TOKEN_SLASH);
+        case CHAR_EQUAL_SUFFIX: return make_token(scanner, match(scanner, '=') ? type + 1 : type);
+        case CHAR_DOUBLE:
+            if (match(scanner, c)) return make_token(scanner, type);
             break;
-        case 'f': return check_keyword(1, 2, "or", TOKEN_FOR);
-        case 'i':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'f': return check_keyword(2, 0, "", TOKEN_IF);
-                    case 'n': return check_keyword(2, 1, "t", TOKEN_INT);
-                }
-            }
+        case CHAR_DOUBLE_QUOTE: return string(scanner);
+        case CHAR_QUOTE: return character(scanner);
+        default:
             break;
-
-        case 'r': return check_keyword(1, 5, "eturn", TOKEN_RETURN);
-        case 'v': return check_keyword(1, 3, "oid", TOKEN_VOID);
-        case 'w': return check_keyword(1, 4, "hile", TOKEN_WHILE);
     }
-    return TOKEN_IDENT;
-}
 
-static token_t* identifier() {
-    while (isalpha(peek()) || isdigit(peek())) advance();
-    return make_token(identifier_type());
+    return error_token(scanner, "Unexpected character.");
 }
 
-static token_t* scan_token() {
-    skip_whitespace();
-    scanner.start = scanner.current;
+token_stream_t* get_tokens(compiler_ctx_t* ctx, const char* source) {
+    scanner_t* scanner = &ctx->scanner;
+    token_stream_t* token_stream = &ctx->token_stream;
+    init_scanner(scanner, source, source, token_stream, ctx);
+    init_token_stream(token_stream, source, strlen(source), 0);
+    scanner->literals = &token_stream->literals;
 
-    if (is_end()) return make_token(TOKEN_EOF);
-    char c = advance();
+    for (;;) {
+        token_t token = scan_token(scanner);
+        // Errors are reported by the scanner and never reach the parser.
+        if (token.type == TOKEN_ERROR)
+            continue;
+        push_token(scanner, &token);
+        if (token.type == TOKEN_EOF)
+            break;
+    }
+    token_stream->had_error = scanner->had_error;
+
+    return token_stream;
+}
 
-    if (isalpha(c)) return identifier();
-    if (isdigit(c)) return number();
+// Scans chunk from offset from, which is chunk->begin unless the previous
+// chunk ended with a token running past it. Errors are only recorded, the
+// caller rescans serially to report them.
+static void scan_chunk(const char* source, lex_chunk_t* chunk, uint32_t from,
+    bool is_last) {
+    scanner_t chunk_scanner;
+    scanner_t* scanner = &chunk_scanner;
+    init_scanner(scanner, source, source + from, &chunk->tokens, NULL);
+    init_token_stream(&chunk->tokens, source,
+        chunk->end > from ? chunk->end - from : 0, 0);
+    scanner->literals = &chunk->tokens.literals;
+
+    const char* limit = source + chunk->end;
+    chunk->last_end = from;
+    for (;;) {
+        token_t token = scan_token(scanner);
+        if (token.type == TOKEN_ERROR)
+            continue;
+        if (!is_last && scanner->start >= limit)
+            break;
+        push_token(scanner, &token);
+        chunk->last_end = (uint32_t)(scanner->current - source);
+        if (token.type == TOKEN_EOF) {
+            // A '\0' before the end of the source, get_tokens() stops there.
+            if (!is_last)
+                scanner->had_error = true;
+            break;
+        }
+    }
 
-   //printf("[%c]\n", c);
-   char* err_msg = "Unexpected character.";
+    chunk->had_error = scanner->had_error;
+}
 
-    switch (c) {
-        case '(': return make_token(TOKEN_LEFT_PAREN);
-        case ')': return make_token(TOKEN_RIGHT_PAREN);
-        case '{': return make_token(TOKEN_LEFT_BRACE);
-        case '}': return make_token(TOKEN_RIGHT_BRACE);
-        case '[': return make_token(TOKEN_LEFT_BRACKET);
-        case ']': return make_token(TOKEN_RIGHT_BRACKET);
-        case ';': return make_token(TOKEN_SEMICOLON);
-        case ',': return make_token(TOKEN_COMMA);
-        case '-': return make_token(TOKEN_MINUS);
-        case '+': return make_token(TOKEN_PLUS);
-        case '/': return make_token(TOKEN_SLASH);
-        case '*': return make_token(TOKEN_STAR);
-        case '!': return make_token(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
-        case '=': return make_token(match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
-        case '<': return make_token(match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
-        case '>': return make_token(match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
-        case '&': return  match('&') ? make_token(TOKEN_AND) : error_token(err_msg);
-        case '|': return  match('|') ? make_token(TOKEN_OR) : error_token(err_msg);
-        case '"': return string();
-        case '\'': return character();
+static void* lex_worker(void* arg) {
+    lex_job_t* job = arg;
+    for (;;) {
+        uint32_t k = atomic_fetch_add(&job->next_chunk, 1);
+        if (k >= job->chunk_count)
+            break;
+        lex_chunk_t* chunk = &job->chunks[k];
+        scan_chunk(job->source, chunk, chunk->begin, k == job->chunk_count - 1);
     }
+    return NULL;
+}
 
-    return error_token(err_msg);
+// Splits the source right after newlines, so a chunk starts where the
+// scanner is between tokens unless a string or char literal spans that
+// newline. Returns the number of chunks.
+static uint32_t split_chunks(const char* source, size_t size,
+    lex_chunk_t* chunks, uint32_t chunk_count) {
+    uint32_t count = 0;
+    uint32_t begin = 0;
+    for (uint32_t k = 1; k <= chunk_count; k++) {
+        size_t end = k == chunk_count ? size : size / chunk_count * k;
+        if (end < begin)
+            continue;
+        if (k < chunk_count) {
+            const char* newline = memchr(source + end, '\n', size - end);
+            if (newline == NULL)
+                continue;
+            end = (size_t)(newline - source) + 1;
+        }
+        if (end == begin)
+            continue;
+        chunks[count].begin = begin;
+        chunks[count].end = (uint32_t)end;
+        count++;
+        begin = (uint32_t)end;
+    }
+    if (count > 0)
+        chunks[count - 1].end = (uint32_t)size;
+    return count;
 }
 
-token_stream_t* get_tokens(const char* source) {
-    init_scanner(source);
-    init_token_stream();
-    token_t* token;
+// Same result as get_tokens(), with the source scanned by jobs threads.
+// Chunks are scanned assuming they start between tokens. When the previous
+// chunk ends with a token running past the start of the next one, the next
+// chunk is scanned again from the end of that token. The per chunk token
+// counts are then summed up to place every chunk in the final stream. Any
+// scan error falls back to get_tokens() so errors are reported in order.
+token_stream_t* get_tokens_parallel(compiler_ctx_t* ctx, const char* source,
+    size_t size, uint32_t jobs) {
+    uint32_t chunk_count = jobs * CHUNKS_PER_JOB;
+    if (size / MIN_CHUNK_SIZE < chunk_count)
+        chunk_count = (uint32_t)(size / MIN_CHUNK_SIZE);
+    if (jobs <= 1 || chunk_count <= 1)
+        return get_tokens(ctx, source);
+
+    init_keyword_table();
+
+    lex_chunk_t* chunks = calloc(chunk_count, sizeof(lex_chunk_t));
+    if (chunks == NULL) {
+        fprintf(stderr, "Could not allocate memory for token_stream\n");
+        exit(EXIT_FAILURE);
+    }
+    lex_job_t job;
+    job.source = source;
+    job.chunks = chunks;
+    job.chunk_count = split_chunks(source, size, chunks, chunk_count);
+    atomic_init(&job.next_chunk, 0);
+
+    pthread_t* threads = grow_array(NULL, jobs, sizeof(pthread_t));
+    uint32_t started = 0;
+    for (; started < jobs - 1; started++) {
+        if (pthread_create(&threads[started], NULL, lex_worker, &job) != 0)
+            break;
+    }
+    lex_worker(&job);
+    for (uint32_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+
+    bool had_error = false;
+    uint32_t token_count = 0;
+    uint32_t literal_size = 0;
+    for (uint32_t k = 0; k < job.chunk_count; k++) {
+        if (k > 0 && chunks[k - 1].last_end > chunks[k].begin) {
+            scan_chunk(source, &chunks[k], chunks[k - 1].last_end,
+                k == job.chunk_count - 1);
+        }
+        had_error |= chunks[k].had_error;
+        token_count += chunks[k].tokens.count;
+        literal_size += chunks[k].tokens.literals.size;
+    }
+
+    if (had_error) {
+        for (uint32_t k = 0; k < job.chunk_count; k++)
+            free_token_stream(&chunks[k].tokens);
+        free(chunks);
+        return get_tokens(ctx, source);
+    }
 
-    for (;;) {
-        token = scan_token();
-        if (token_stream.count > 0) {
-            if (token->type == TOKEN_EOF)
-                break;
+    token_stream_t* token_stream = &ctx->token_stream;
+    init_token_stream(token_stream, source, size, token_count);
+    token_stream->count = token_count;
+    token_stream->literals.bytes = grow_array(NULL, literal_size + 1,
+        sizeof(char));
+    token_stream->literals.capacity = literal_size + 1;
+    token_stream->literals.size = literal_size;
+
+    uint32_t token_at = 0;
+    uint32_t literal_at = 0;
+    for (uint32_t k = 0; k < job.chunk_count; k++) {
+        token_stream_t* tokens = &chunks[k].tokens;
+        memcpy(token_stream->types + token_at, tokens->types,
+            tokens->count * sizeof(uint8_t));
+        memcpy(token_stream->offsets + token_at, tokens->offsets,
+            tokens->count * sizeof(uint32_t));
+        memcpy(token_stream->lengths + token_at, tokens->lengths,
+            tokens->count * sizeof(uint32_t));
+        memcpy(token_stream->values + token_at, tokens->values,
+            tokens->count * sizeof(uint32_t));
+        memcpy(token_stream->literals.bytes + literal_at,
+            tokens->literals.bytes, tokens->literals.size);
+        // Strings were decoded into the chunk's own pool.
+        for (uint32_t i = 0; i < tokens->count; i++) {
+            if (tokens->types[i] == TOKEN_STRING)
+                token_stream->values[token_at + i] += literal_at;
         }
+        literal_at += tokens->literals.size;
+        token_at += tokens->count;
+        free_token_stream(tokens);
     }
+    free(chunks);
+
+    return token_stream;
+}
 
-    return &token_stream;
+// Only the literal pool of ctx->token_stream is used.
+void open_token_source(compiler_ctx_t* ctx, const char* source,
+    bool report_errors) {
+    init_scanner(&ctx->scanner, source, source, NULL,
+        report_errors ? ctx : NULL);
+    ctx->token_stream.literals.size = 0;
+    ctx->scanner.literals = &ctx->token_stream.literals;
+}
+
+// Scans the next token of the source given to open_token_source(). Once the
+// end is reached every call returns the EOF token.
+token_t pull_token(compiler_ctx_t* ctx) {
+    token_t token;
+    do {
+        token = scan_token(&ctx->scanner);
+    } while (token.type == TOKEN_ERROR);
+    return token;
+}
+
+token_t get_token(token_stream_t* token_stream, uint32_t index) {
+    token_t token;
+    token.type = token_stream->types[index];
+    token.offset = token_stream->offsets[index];
+    token.start = token_stream->source + token.offset;
+    token.length = token_stream->lengths[index];
+    token.value = token_stream->values[index];
+    return token;
+}
+
+// The decoded text of a string token, which may contain '\0'.
+const char* literal_string(literal_pool_t* literals, token_t* token,
+    uint32_t* length) {
+    memcpy(length, literals->bytes + token->value, sizeof(uint32_t));
+    return literals->bytes + token->value + sizeof(uint32_t);
 }
 
 char* token_type_str(token_type_t type) {
@@ -339,14 +713,3 @@ char *stringify_token_type(token_type_t type) {
         default: return "unkown";
     }
 }
-
-char* lexeme(token_t* token) {
-    char *s = malloc(token->length + 1);
-    if (s == NULL) {
-        fprintf(stderr, "Could not allocate memory for lexeme\n");
-        exit(EXIT_FAILURE);
-    }
-    memcpy(s, token->start, token->length);
-    s[token->length] = '\0';
-    return s;
-}
\ No newline at end of file
@@ -3,19 +3,48 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include "token.h"
 
-#define CAPACITY_STEP 32
+typedef struct compiler_ctx compiler_ctx_t;
+
+#define MIN_CAPACITY 64
+// Used to size the token arrays up front from the input size.
+#define BYTES_PER_TOKEN_ESTIMATE 6
+// Parallel scanning splits the source in up to CHUNKS_PER_JOB chunks per
+// thread, none smaller than MIN_CHUNK_SIZE bytes.
+#define CHUNKS_PER_JOB 4
+#define MIN_CHUNK_SIZE (256 * 1024)
+// Must be a power of two.
+#define KEYWORD_TABLE_SIZE 32
+// Largest number literal, the largest int.
+#define MAX_NUMBER_VALUE 2147483647u
 
 typedef struct {
+    const char* source;
     const char* start;
     const char* current;
-    uint32_t line;
+    // Where tokens are stored, NULL when they are pulled one
+    // at a time with pull_token().
+    token_stream_t* token_stream;
+    // Where string literals are decoded to.
+    literal_pool_t* literals;
+    // Where errors are reported, NULL when they are not.
+    compiler_ctx_t* ctx;
+    bool had_error;
 } scanner_t;
 
-token_stream_t* get_tokens(const char* source);
+token_stream_t* get_tokens(compiler_ctx_t* ctx, const char* source);
+token_stream_t* get_tokens_parallel(compiler_ctx_t* ctx, const char* source,
+    size_t size, uint32_t jobs);
+void open_token_source(compiler_ctx_t* ctx, const char* source,
+    bool report_errors);
+token_t pull_token(compiler_ctx_t* ctx);
+token_t get_token(token_stream_t* token_stream, uint32_t index);
+void free_token_stream(token_stream_t* token_stream);
 char *stringify_token_type(token_type_t type);
 char* token_type_str(token_type_t type);
-char* lexeme(token_t* token);
+const char* literal_string(literal_pool_t* literals, token_t* token,
+    uint32_t* length);
 
 #endif
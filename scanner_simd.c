@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "scanner_simd.h"
+#include "char_class.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+/*
+ * The vector versions only use aligned loads. The first block is loaded from
+ * the aligned address at or below p and the bytes before p are shifted out of
+ * the mask. An aligned block never crosses a page, and every run stops at the
+ * '\0' terminator, so nothing past the page holding the end of the source is
+ * touched. Heap buffers are aligned and padded to SCANNER_SIMD_BLOCK for the
+ * same reason.
+ */
+
+static simd_level_t current_level = SIMD_SCALAR;
+
+
+static const char* span_blanks_scalar(const char* p) {
+    while (IS_BLANK(*p)) p++;
+    return p;
+}
+
+static const char* find_line_end_scalar(const char* p) {
+    while (*p != '\n' && *p != '\0') p++;
+    return p;
+}
+
+static const char* span_alnum_scalar(const char* p) {
+    while (IS_ALNUM(*p)) p++;
+    return p;
+}
+
+static const char* span_digits_scalar(const char* p) {
+    while (IS_DIGIT(*p)) p++;
+    return p;
+}
+
+#ifdef HAVE_X86_SIMD
+
+#define SSE2_STEP 16
+#define AVX2_STEP 32
+_Static_assert(SCANNER_SIMD_BLOCK % AVX2_STEP == 0,
+    "source buffers must be padded to whole vector blocks");
+
+// Bytes in [low, high]. Bytes >= 0x80 compare as negative and never match.
+static inline __m128i in_range_sse2(__m128i v, char low, char high) {
+    return _mm_and_si128(
+        _mm_cmpgt_epi8(v, _mm_set1_epi8(low - 1)),
+        _mm_cmplt_epi8(v, _mm_set1_epi8(high + 1)));
+}
+
+static inline __m128i blank_sse2(__m128i v) {
+    return _mm_or_si128(
+        _mm_or_si128(
+            _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+            _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+}
+
+static inline __m128i line_end_sse2(__m128i v) {
+    return _mm_or_si128(
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+        _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+}
+
+static inline __m128i digit_sse2(__m128i v) {
+    return in_range_sse2(v, '0', '9');
+}
+
+static inline __m128i alnum_sse2(__m128i v) {
+    // Setting bit 5 folds upper case letters into lower case.
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    return _mm_or_si128(in_range_sse2(lower, 'a', 'z'), digit_sse2(v));
+}
+
+// Expands to a function returning the first byte where STOP(block) is set.
+#define DEFINE_FIND_SSE2(name, STOP)                                        \
+static const char* name(const char* p) {                                    \
+    uintptr_t misalign = (uintptr_t)p & (SSE2_STEP - 1);                    \
+    const char* block = p - misalign;                                       \
+    __m128i v = _mm_load_si128((const __m128i*)block);                      \
+    uint32_t mask = (uint32_t)_mm_movemask_epi8(STOP(v)) >> misalign;       \
+    if (mask != 0)                                                          \
+        return p + __builtin_ctz(mask);                                     \
+    for (;;) {                                                              \
+        block += SSE2_STEP;                                                 \
+        v = _mm_load_si128((const __m128i*)block);                          \
+        mask = (uint32_t)_mm_movemask_epi8(STOP(v));                        \
+        if (mask != 0)                                                      \
+            return block + __builtin_ctz(mask);                             \
+    }                                                                       \
+}
+
+#define NOT_BLANK_SSE2(v) _mm_xor_si128(blank_sse2(v), _mm_set1_epi8(-1))
+#define NOT_ALNUM_SSE2(v) _mm_xor_si128(alnum_sse2(v), _mm_set1_epi8(-1))
+#define NOT_DIGIT_SSE2(v) _mm_xor_si128(digit_sse2(v), _mm_set1_epi8(-1))
+
+DEFINE_FIND_SSE2(span_blanks_sse2, NOT_BLANK_SSE2)
+DEFINE_FIND_SSE2(find_line_end_sse2, line_end_sse2)
+DEFINE_FIND_SSE2(span_alnum_sse2, NOT_ALNUM_SSE2)
+DEFINE_FIND_SSE2(span_digits_sse2, NOT_DIGIT_SSE2)
+
+#define AVX2 __attribute__((target("avx2")))
+
+static inline AVX2 __m256i in_range_avx2(__m256i v, char low, char high) {
+    return _mm256_and_si256(
+        _mm256_cmpgt_epi8(v, _mm256_set1_epi8(low - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8(high + 1), v));
+}
+
+static inline AVX2 __m256i blank_avx2(__m256i v) {
+    return _mm256_or_si256(
+        _mm256_or_si256(
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+}
+
+static inline AVX2 __m256i line_end_avx2(__m256i v) {
+    return _mm256_or_si256(
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+        _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+}
+
+static inline AVX2 __m256i digit_avx2(__m256i v) {
+    return in_range_avx2(v, '0', '9');
+}
+
+static inline AVX2 __m256i alnum_avx2(__m256i v) {
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    return _mm256_or_si256(in_range_avx2(lower, 'a', 'z'), digit_avx2(v));
+}
+
+#define DEFINE_FIND_AVX2(name, STOP)                                        \
+static AVX2 const char* name(const char* p) {                               \
+    uintptr_t misalign = (uintptr_t)p & (AVX2_STEP - 1);                    \
+    const char* block = p - misalign;                                       \
+    __m256i v = _mm256_load_si256((const __m256i*)block);                   \
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(STOP(v)) >> misalign;    \
+    if (mask != 0)                                                          \
+        return p + __builtin_ctz(mask);                                     \
+    for (;;) {                                                              \
+        block += AVX2_STEP;                                                 \
+        v = _mm256_load_si256((const __m256i*)block);                       \
+        mask = (uint32_t)_mm256_movemask_epi8(STOP(v));                     \
+        if (mask != 0)                                                      \
+            return block + __builtin_ctz(mask);                             \
+    }                                                                       \
+}
+
+#define NOT_BLANK_AVX2(v) _mm256_xor_si256(blank_avx2(v), _mm256_set1_epi8(-1))
+#define NOT_ALNUM_AVX2(v) _mm256_xor_si256(alnum_avx2(v), _mm256_set1_epi8(-1))
+#define NOT_DIGIT_AVX2(v) _mm256_xor_si256(digit_avx2(v), _mm256_set1_epi8(-1))
+
+DEFINE_FIND_AVX2(span_blanks_avx2, NOT_BLANK_AVX2)
+DEFINE_FIND_AVX2(find_line_end_avx2, line_end_avx2)
+DEFINE_FIND_AVX2(span_alnum_avx2, NOT_ALNUM_AVX2)
+DEFINE_FIND_AVX2(span_digits_avx2, NOT_DIGIT_AVX2)
+
+#endif
+
+scanner_simd_t scanner_simd = {
+    span_blanks_scalar,
+    find_line_end_scalar,
+    span_alnum_scalar,
+    span_digits_scalar,
+};
+
+char* alloc_source_buffer(size_t size) {
+    size_t padded = (size / SCANNER_SIMD_BLOCK + 1) * SCANNER_SIMD_BLOCK;
+    char* buffer = aligned_alloc(SCANNER_SIMD_BLOCK, padded);
+    if (buffer != NULL)
+        memset(buffer + size, 0, padded - size);
+    return buffer;
+}
+
+static bool cpu_supports(simd_level_t level) {
+    switch (level) {
+        case SIMD_SCALAR: return true;
+#ifdef HAVE_X86_SIMD
+        case SIMD_SSE2: return __builtin_cpu_supports("sse2");
+        case SIMD_AVX2: return __builtin_cpu_supports("avx2");
+#endif
+        default: return false;
+    }
+}
+
+// Picks the widest supported level for SIMD_AUTO. Returns false when an
+// explicitly requested level is not supported by this CPU.
+bool init_scanner_simd(simd_level_t level) {
+    if (level == SIMD_AUTO) {
+        if (cpu_supports(SIMD_AVX2)) level = SIMD_AVX2;
+        else if (cpu_supports(SIMD_SSE2)) level = SIMD_SSE2;
+        else level = SIMD_SCALAR;
+    }
+
+    if (!cpu_supports(level))
+        return false;
+
+    switch (level) {
+#ifdef HAVE_X86_SIMD
+        case SIMD_SSE2:
+            scanner_simd.span_blanks = span_blanks_sse2;
+            scanner_simd.find_line_end = find_line_end_sse2;
+            scanner_simd.span_alnum = span_alnum_sse2;
+            scanner_simd.span_digits = span_digits_sse2;
+            break;
+        case SIMD_AVX2:
+            scanner_simd.span_blanks = span_blanks_avx2;
+            scanner_simd.find_line_end = find_line_end_avx2;
+            scanner_simd.span_alnum = span_alnum_avx2;
+            scanner_simd.span_digits = span_digits_avx2;
+            break;
+#endif
+        default:
+            scanner_simd.span_blanks = span_blanks_scalar;
+            scanner_simd.find_line_end = find_line_end_scalar;
+            scanner_simd.span_alnum = span_alnum_scalar;
+            scanner_simd.span_digits = span_digits_scalar;
+            break;
+    }
+    current_level = level;
+    return true;
+}
+
+simd_level_t scanner_simd_level() {
+    return current_level;
+}
+
+bool simd_level_from_str(const char* str, simd_level_t* level) {
+    if (!strcmp(str, "auto")) *level = SIMD_AUTO;
+    else if (!strcmp(str, "scalar")) *level = SIMD_SCALAR;
+    else if (!strcmp(str, "sse2")) *level = SIMD_SSE2;
+    else if (!strcmp(str, "avx2")) *level = SIMD_AVX2;
+    else return false;
+    return true;
+}
+
+char* simd_level_str(simd_level_t level) {
+    switch (level) {
+        case SIMD_AUTO: return "auto";
+        case SIMD_SCALAR: return "scalar";
+        case SIMD_SSE2: return "sse2";
+        case SIMD_AVX2: return "avx2";
+        default: return "unknown";
+    }
+}
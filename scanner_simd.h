@@ -0,0 +1,38 @@
+#ifndef cmm_scanner_simd_h
+#define cmm_scanner_simd_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    SIMD_AUTO, SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2
+} simd_level_t;
+
+// Each function returns the first byte at or after p that does not belong to
+// the run it skips. The '\0' terminator always ends a run, so none of them
+// read past the block holding the end of the source.
+typedef struct {
+    const char* (*span_blanks)(const char* p);
+    const char* (*find_line_end)(const char* p);
+    const char* (*span_alnum)(const char* p);
+    const char* (*span_digits)(const char* p);
+} scanner_simd_t;
+
+extern scanner_simd_t scanner_simd;
+
+// The vector versions load whole aligned blocks of this size, so they may
+// read before p and past the '\0' within the blocks holding them. A source
+// must be mapped, or allocated with alloc_source_buffer().
+#define SCANNER_SIMD_BLOCK 32
+
+// Room for size bytes and the '\0' terminator, starting on a block and
+// zero padded to the end of the block holding the terminator. Returns NULL
+// when out of memory.
+char* alloc_source_buffer(size_t size);
+
+bool init_scanner_simd(simd_level_t level);
+simd_level_t scanner_simd_level();
+bool simd_level_from_str(const char* str, simd_level_t* level);
+char* simd_level_str(simd_level_t level);
+
+#endif
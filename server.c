@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "server.h"
+#include "compiler.h"
+#include "compiler_ctx.h"
+#include "scanner_simd.h"
+
+#define READ_CHUNK_SIZE (64 * 1024)
+// Token and node offsets are 32 bits, larger sources cannot be compiled.
+#define MAX_SOURCE_SIZE UINT32_MAX
+// How long a worker waits before accepting again when out of descriptors.
+#define ACCEPT_BACKOFF_US (100 * 1000)
+// How long a worker waits on a client that stops sending or reading before
+// dropping it, so idle connections cannot hold every worker.
+#define CLIENT_TIMEOUT_SECONDS 10
+
+typedef struct {
+    opts_t* opts;
+    int listen_fd;
+} server_t;
+
+static bool write_all(int fd, const char* buffer, size_t size) {
+    while (size > 0) {
+        ssize_t written = send(fd, buffer, size, MSG_NOSIGNAL);
+        if (written <= 0)
+            return false;
+        buffer += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+static bool read_all(int fd, char* buffer, size_t size) {
+    while (size > 0) {
+        ssize_t bytes_read = read(fd, buffer, size);
+        if (bytes_read <= 0)
+            return false;
+        buffer += bytes_read;
+        size -= (size_t)bytes_read;
+    }
+    return true;
+}
+
+// Reads up to the '\n' ending a header, which is replaced with '\0'.
+static bool read_header(int fd, char* header) {
+    for (size_t i = 0; i < MAX_HEADER_LENGTH; i++) {
+        if (read(fd, &header[i], 1) != 1)
+            return false;
+        if (header[i] == '\n') {
+            header[i] = '\0';
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool socket_address(const char* path, struct sockaddr_un* addr) {
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "Socket path \"%s\" is too long.\n", path);
+        return false;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+static bool apply_flags(opts_t* opts, const char* flags) {
+    if (strcmp(flags, "-") == 0)
+        return true;
+    for (const char* c = flags; *c != '\0'; c++) {
+        switch (*c) {
+            case 't' : opts->tokens  = true; break;
+            case 'a' : opts->ast     = true; break;
+            case 's' : opts->symbols = true; break;
+            case 'S' : opts->stats   = true; break;
+            case 'm' : opts->stream  = true; break;
+            case 'd' : opts->decls   = true; break;
+            case 'y' : opts->syntax_only = true; break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+static void send_response(int fd, bool ok, char* out, size_t out_size,
+    char* err, size_t err_size) {
+    char header[MAX_HEADER_LENGTH];
+    int length = snprintf(header, sizeof(header), "%d %zu %zu\n",
+        ok ? 0 : 1, out_size, err_size);
+    if (write_all(fd, header, (size_t)length) &&
+        write_all(fd, out, out_size))
+        write_all(fd, err, err_size);
+}
+
+// Compiles what one request asks for with the worker's context. The dumps
+// and diagnostics are collected in memory and sent back as the response.
+static void handle_request(compiler_ctx_t* ctx, opts_t* server_opts, int fd) {
+    char header[MAX_HEADER_LENGTH];
+    char flags[16];
+    char kind[16];
+    size_t size;
+
+    opts_t opts = *server_opts;
+    opts.tokens = opts.ast = opts.symbols = opts.stats = opts.stream = false;
+    opts.decls = opts.syntax_only = false;
+
+    if (!read_header(fd, header) ||
+        sscanf(header, "%15s %15s %zu", flags, kind, &size) != 3 ||
+        !apply_flags(&opts, flags) || (opts.syntax_only && opts.ast) ||
+        (strcmp(kind, "path") != 0 && strcmp(kind, "source") != 0) ||
+        (strcmp(kind, "path") == 0 && size >= PATH_MAX) ||
+        (strcmp(kind, "source") == 0 && size > MAX_SOURCE_SIZE)) {
+        char msg[] = "Bad request.\n";
+        send_response(fd, false, NULL, 0, msg, sizeof(msg) - 1);
+        return;
+    }
+
+    char* payload = alloc_source_buffer(size);
+    if (payload == NULL) {
+        char msg[] = "Not enough memory for the request.\n";
+        send_response(fd, false, NULL, 0, msg, sizeof(msg) - 1);
+        return;
+    }
+    if (!read_all(fd, payload, size)) {
+        free(payload);
+        return;
+    }
+    payload[size] = '\0';
+
+    char* out = NULL;
+    char* err = NULL;
+    size_t out_size = 0;
+    size_t err_size = 0;
+    ctx->out = open_memstream(&out, &out_size);
+    ctx->err = open_memstream(&err, &err_size);
+    if (ctx->out == NULL || ctx->err == NULL) {
+        fprintf(stderr, "Could not allocate memory for request output\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bool ok;
+    if (strcmp(kind, "path") == 0) {
+        size_t bytes;
+        ok = compile_file(ctx, &opts, payload, 1, &bytes);
+    } else {
+        ok = compile_source(ctx, &opts, payload, size);
+    }
+    fclose(ctx->out);
+    fclose(ctx->err);
+
+    send_response(fd, ok, out, out_size, err, err_size);
+    free(out);
+    free(err);
+    free(payload);
+}
+
+// Every worker accepts connections on the shared socket and keeps its
+// context between requests, so a request only pays for the compilation.
+static void* server_worker(void* arg) {
+    server_t* server = arg;
+    compiler_ctx_t* ctx = create_compiler_ctx();
+
+    for (;;) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // Descriptors or memory free up as other requests finish.
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS ||
+                errno == ENOMEM) {
+                usleep(ACCEPT_BACKOFF_US);
+                continue;
+            }
+            fprintf(stderr, "Could not accept connections: %s\n",
+                strerror(errno));
+            break;
+        }
+        struct timeval timeout = { CLIENT_TIMEOUT_SECONDS, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        handle_request(ctx, server->opts, fd);
+        close(fd);
+    }
+
+    free_compiler_ctx(ctx);
+    return NULL;
+}
+
+// Serves requests on the --server socket with the given number of worker
+// threads until the process is killed. Returns false if the socket could
+// not be set up or stopped accepting connections.
+bool serve(opts_t* opts, uint32_t workers) {
+    struct sockaddr_un addr;
+    if (!socket_address(opts->server, &addr))
+        return false;
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        fprintf(stderr, "Could not create socket.\n");
+        return false;
+    }
+    unlink(opts->server);
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "Could not listen on \"%s\".\n", opts->server);
+        close(listen_fd);
+        return false;
+    }
+
+    server_t server = { opts, listen_fd };
+    pthread_t thread;
+    for (uint32_t i = 1; i < workers; i++) {
+        if (pthread_create(&thread, NULL, server_worker, &server) != 0) {
+            fprintf(stderr, "Could not create worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(thread);
+    }
+    server_worker(&server);
+    return false;
+}
+
+// Reads the whole standard input for a "source" request.
+static char* read_stdin(size_t* size) {
+    size_t capacity = READ_CHUNK_SIZE;
+    size_t bytes_read = 0;
+    char* buffer = NULL;
+
+    for (;;) {
+        buffer = realloc(buffer, capacity);
+        if (buffer == NULL) {
+            fprintf(stderr, "Not enough memory to read standard input.\n");
+            exit(EXIT_FAILURE);
+        }
+        bytes_read += fread(buffer + bytes_read, sizeof(char),
+            capacity - bytes_read, stdin);
+        if (bytes_read < capacity)
+            break;
+        capacity *= 2;
+    }
+    *size = bytes_read;
+    return buffer;
+}
+
+// Copies size bytes of the response to fp.
+static bool forward(int fd, size_t size, FILE* fp) {
+    char buffer[READ_CHUNK_SIZE];
+    while (size > 0) {
+        size_t chunk = size < sizeof(buffer) ? size : sizeof(buffer);
+        if (!read_all(fd, buffer, chunk))
+            return false;
+        fwrite(buffer, 1, chunk, fp);
+        size -= chunk;
+    }
+    return true;
+}
+
+// Sends one request for a file to the --client socket, a file named "-" is
+// sent as source read from standard input. Paths are made absolute since
+// the server runs elsewhere. Grouped output has the headers of a batch.
+static bool request(opts_t* opts, struct sockaddr_un* addr,
+    const char* filename, bool grouped) {
+    char flags[16];
+    char* f = flags;
+    if (opts->tokens)  *f++ = 't';
+    if (opts->ast)     *f++ = 'a';
+    if (opts->symbols) *f++ = 's';
+    if (opts->stats)   *f++ = 'S';
+    if (opts->stream)  *f++ = 'm';
+    if (opts->decls)   *f++ = 'd';
+    if (opts->syntax_only) *f++ = 'y';
+    if (f == flags)    *f++ = '-';
+    *f = '\0';
+
+    char path[PATH_MAX];
+    const char* kind = "path";
+    char* payload;
+    size_t size;
+    if (strcmp(filename, "-") == 0) {
+        kind = "source";
+        payload = read_stdin(&size);
+    } else {
+        if (realpath(filename, path) == NULL) {
+            if (grouped)
+                fprintf(stderr, "File: %s\n", filename);
+            fprintf(stderr, "Could not open file \"%s\".\n", filename);
+            return false;
+        }
+        payload = path;
+        size = strlen(path);
+    }
+
+    bool ok = false;
+    char header[MAX_HEADER_LENGTH];
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)addr, sizeof(*addr)) != 0) {
+        fprintf(stderr, "Could not connect to \"%s\".\n", opts->client);
+    } else {
+        int length = snprintf(header, sizeof(header), "%s %s %zu\n",
+            flags, kind, size);
+        int status;
+        size_t out_size;
+        size_t err_size;
+        bool received = write_all(fd, header, (size_t)length) &&
+            write_all(fd, payload, size) &&
+            read_header(fd, header) &&
+            sscanf(header, "%d %zu %zu", &status, &out_size, &err_size) == 3 &&
+            forward(fd, out_size, stdout);
+        if (received && err_size > 0 && grouped) {
+            fflush(stdout);
+            fprintf(stderr, "File: %s\n", filename);
+        }
+        if (received && forward(fd, err_size, stderr))
+            ok = status == 0;
+        else
+            fprintf(stderr, "Bad response from \"%s\".\n", opts->client);
+    }
+    if (fd >= 0)
+        close(fd);
+    if (payload != path)
+        free(payload);
+    return ok;
+}
+
+bool run_client(opts_t* opts) {
+    struct sockaddr_un addr;
+    if (!socket_address(opts->client, &addr))
+        return false;
+
+    bool ok = true;
+    for (uint32_t i = 0; i < opts->file_count; i++) {
+        if (opts->file_count > 1) {
+            printf("File: %s\n", opts->filenames[i]);
+            fflush(stdout);
+        }
+        if (!request(opts, &addr, opts->filenames[i], opts->file_count > 1))
+            ok = false;
+        fflush(stdout);
+    }
+    return ok;
+}
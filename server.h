@@ -0,0 +1,20 @@
+#ifndef cmm_server_h
+#define cmm_server_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "opt_parser.h"
+
+// Longest request or response header, "\n" included.
+#define MAX_HEADER_LENGTH 128
+
+// A request is "<flags> <kind> <length>\n" followed by length bytes. flags
+// holds the letters of the dump options asked for (t, a, s, S, m, d, y) or "-".
+// kind is "path" when the bytes name a file to compile, or "source" when
+// they are the source itself. The response is "<status> <out> <err>\n"
+// followed by out bytes of dumps and err bytes of diagnostics. status is 0
+// when the compilation succeeded.
+bool serve(opts_t* opts, uint32_t workers);
+bool run_client(opts_t* opts);
+
+#endif
@@ -5,195 +5,364 @@
 #include <stdbool.h>
 #include "sym_table.h"
 #include "ast.h"
+#include "line_index.h"
+#include "compiler_ctx.h"
+
+// Smallest number of binding slots and of open scope slots allocated.
+#define SYM_TABLE_MIN_CAPACITY 64
+
+// The murmur3 finalizer, a bijection: distinct ids keep distinct hashes.
+static uint32_t mix(uint32_t hash) {
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+    return hash;
+}
 
-bool defining_a_declaration;
+static uint32_t home_slot(const sym_table_t* table, atom_t* sym) {
+    return mix(sym->id ^ table->seed) & (table->capacity - 1);
+}
 
-static uint32_t hash(char *str) {
-    uint32_t hash = 5381;
-    int c;
-    while ((c = *str++))
-        hash = ((hash << 5) + hash) + c;
-    return hash;
+// The slot of sym, or the empty slot it would take. Names are atoms, equal
+// names are the same pointer.
+static sym_binding_t* find_binding(const sym_table_t* table, atom_t* sym) {
+    uint32_t mask = table->capacity - 1;
+    for (uint32_t i = home_slot(table, sym);; i = (i + 1) & mask) {
+        sym_binding_t* binding = &table->slots[i];
+        if (binding->sym == NULL || binding->sym == sym)
+            return binding;
+    }
 }
 
-sym_entry_t* sym_lookup(sym_table_t* scope, char *sym) {
-    uint32_t pos = hash(sym) % MAX_ENTRIES;
-    sym_entry_t* entry = scope->entries[pos];
+sym_entry_t* sym_lookup(sym_table_t* table, atom_t* sym) {
+    if (table->slots == NULL)
+        return NULL;
+    return find_binding(table, sym)->entry;
+}
 
-    while (entry) {
-        if (!strcmp(sym, entry->sym)) return entry;
-        entry = entry->next;
+// The global sym is bound to, looking past the locals that hide it.
+sym_entry_t* sym_lookup_global(sym_table_t* table, atom_t* sym) {
+    sym_entry_t* entry = sym_lookup(table, sym);
+    while (entry != NULL && entry->depth > 0)
+        entry = entry->shadowed;
+    return entry;
+}
+
+static void* grow_array(void* items, uint32_t* capacity, uint32_t needed,
+    size_t item_size) {
+    uint32_t old_capacity = *capacity;
+    uint32_t new_capacity = old_capacity < SYM_TABLE_MIN_CAPACITY ?
+        SYM_TABLE_MIN_CAPACITY : old_capacity * 2;
+    if (new_capacity < needed)
+        new_capacity = needed;
+    items = realloc(items, new_capacity * item_size);
+    if (items == NULL) {
+        fprintf(stderr, "Could not allocate memory for sym_table\n");
+        exit(EXIT_FAILURE);
     }
-    return NULL;
+    memset((char*)items + old_capacity * item_size, 0,
+        (new_capacity - old_capacity) * item_size);
+    *capacity = new_capacity;
+    return items;
 }
 
-static sym_entry_t* create_sym_entry(char* sym, sym_type_t type) {
-    sym_entry_t* entry = malloc(sizeof(sym_entry_t));
-    if (entry == NULL) {
-        fprintf(stderr, "Could not allocate memory for sym_entry\n");
+static sym_binding_t* alloc_slots(uint32_t capacity) {
+    sym_binding_t* slots = calloc(capacity, sizeof(sym_binding_t));
+    if (slots == NULL) {
+        fprintf(stderr, "Could not allocate memory for sym_table\n");
         exit(EXIT_FAILURE);
     }
+    return slots;
+}
+
+// Doubles the slots, a table is at most 3/4 full.
+static void grow_slots(sym_table_t* table) {
+    sym_binding_t* old_slots = table->slots;
+    uint32_t old_capacity = table->capacity;
+    table->capacity = old_capacity == 0 ?
+        SYM_TABLE_MIN_CAPACITY : old_capacity * 2;
+    table->slots = alloc_slots(table->capacity);
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i].sym != NULL)
+            *find_binding(table, old_slots[i].sym) = old_slots[i];
+    }
+    free(old_slots);
+}
+
+// Makes entry the innermost binding of its name, in the innermost scope.
+static void bind_entry(sym_table_t* table, sym_entry_t* entry) {
+    if ((table->names + 1) * 4 > table->capacity * 3)
+        grow_slots(table);
+    sym_binding_t* binding = find_binding(table, entry->sym);
+    if (binding->sym == NULL) {
+        binding->sym = entry->sym;
+        table->names++;
+    }
+    if (table->depth > 0) {
+        if (table->bound_count == table->bound_capacity) {
+            table->bound = grow_array(table->bound, &table->bound_capacity,
+                table->bound_count + 1, sizeof(sym_entry_t*));
+        }
+        table->bound[table->bound_count++] = entry;
+    }
+    entry->shadowed = binding->entry;
+    entry->depth = table->depth;
+    binding->entry = entry;
+}
+
+// Scopes nest. Opening and closing one allocates nothing once the table
+// has seen as many bindings.
+void open_scope(sym_table_t* table) {
+    if (table->depth == table->marks_capacity) {
+        table->marks = grow_array(table->marks, &table->marks_capacity,
+            table->depth + 1, sizeof(uint32_t));
+    }
+    table->marks[table->depth++] = table->bound_count;
+    if (table->depth > table->max_depth)
+        table->max_depth = table->depth;
+}
+
+void close_scope(sym_table_t* table) {
+    uint32_t mark = table->marks[--table->depth];
+    while (table->bound_count > mark) {
+        sym_entry_t* entry = table->bound[--table->bound_count];
+        find_binding(table, entry->sym)->entry = entry->shadowed;
+    }
+}
+
+// Binds the entries of scope again in the innermost scope.
+void bind_scope(sym_table_t* table, sym_scope_t* scope) {
+    for (sym_entry_t* entry = scope->first; entry; entry = entry->next)
+        bind_entry(table, entry);
+}
+
+// Declares entry, whose name must not be bound in the innermost scope, and
+// records it in scope if there is one.
+static void insert_entry(sym_table_t* table, sym_scope_t* scope,
+    sym_entry_t* entry) {
+    bind_entry(table, entry);
+    if (scope == NULL)
+        return;
+    if (scope->last != NULL)
+        scope->last->next = entry;
+    else
+        scope->first = entry;
+    scope->last = entry;
+}
+
+// Returns the entry sym is declared with in the innermost scope, if any.
+static sym_entry_t* lookup_in_scope(sym_table_t* table, atom_t* sym) {
+    sym_entry_t* entry = sym_lookup(table, sym);
+    return entry != NULL && entry->depth == table->depth ? entry : NULL;
+}
+
+static sym_entry_t* create_sym_entry(sym_table_t* table, atom_t* sym,
+    sym_type_t type, uint32_t offset) {
+    sym_entry_t* entry = arena_alloc(&table->arena, sizeof(sym_entry_t));
     entry->type = type;
-    entry->sym = strdup(sym);
-    entry->next = NULL;
+    entry->sym = sym;
+    entry->offset = offset;
+    entry->declared_offset = offset;
+    table->entries++;
     return entry;
 }
 
-sym_table_t* create_sym_table(sym_table_t* parent) {
-    sym_table_t* sym_table = malloc(sizeof(sym_table_t));
-    if (sym_table == NULL) {
+sym_table_t* create_sym_table(void) {
+    sym_table_t* table = calloc(1, sizeof(sym_table_t));
+    if (table == NULL) {
         fprintf(stderr, "Could not allocate memory for sym_table\n");
         exit(EXIT_FAILURE);
     }
-    memset(sym_table, 0, sizeof(sym_table_t));
-    sym_table->parent = parent;
-    sym_table->accepts_new_var = true;
-    return sym_table;
+    table->globals.accepts_new_var = true;
+    // With ASLR the address differs between runs.
+    table->seed = mix((uint32_t)((uintptr_t)table >> 4));
+    return table;
+}
+
+// Returns a table with the globals of table bound, for a thread to declare
+// locals in while table is only read. Its entries go to table with
+// join_sym_table().
+sym_table_t* fork_sym_table(const sym_table_t* table) {
+    sym_table_t* fork = create_sym_table();
+    if (table->capacity > 0) {
+        fork->slots = alloc_slots(table->capacity);
+        memcpy(fork->slots, table->slots,
+            table->capacity * sizeof(sym_binding_t));
+        fork->capacity = table->capacity;
+        fork->names = table->names;
+        fork->seed = table->seed;
+    }
+    return fork;
 }
 
-bool insert_sym_from_vardecl_node(sym_table_t* scope, ast_node_t* node) {
+// Takes the entries made in fork and frees it.
+void join_sym_table(sym_table_t* table, sym_table_t* fork) {
+    adopt_arena(&table->arena, &fork->arena);
+    table->entries += fork->entries;
+    if (fork->max_depth > table->max_depth)
+        table->max_depth = fork->max_depth;
+    free_sym_table(fork);
+}
 
-    if (!scope->accepts_new_var)
+void free_sym_table(sym_table_t* table) {
+    if (table == NULL)
+        return;
+    free(table->slots);
+    free(table->bound);
+    free(table->marks);
+    free_arena(&table->arena);
+    free(table);
+}
+
+bool insert_sym_from_vardecl_node(compiler_ctx_t* ctx, sym_table_t* table,
+    sym_scope_t* scope, ast_node_t* node) {
+
+    if (scope != NULL && !scope->accepts_new_var)
         return true;
 
     ast_node_t* ident = node->as.vardecl.ident;
-    char* sym =  ident->as.ident.value;
-    sym_entry_t* entry = sym_lookup(scope, sym);
+    atom_t* sym = ident->as.ident.atom;
+    sym_entry_t* entry = lookup_in_scope(table, sym);
 
     if (entry == NULL) {
-        uint32_t pos = hash(sym) % MAX_ENTRIES;
-        sym_entry_t* new_entry = create_sym_entry(sym, SYM_VAR);
-        new_entry->line = node->line;
+        sym_entry_t* new_entry = create_sym_entry(table, sym, SYM_VAR,
+            node->offset);
         new_entry->as.var.type = node->as.vardecl.type;
         new_entry->as.var.is_array = node->as.vardecl.is_array;
-
-        new_entry->next = scope->entries[pos];
-        scope->entries[pos] = new_entry;
+        ident->as.ident.entry = new_entry;
+        insert_entry(table, scope, new_entry);
         return true;
     } else {
-        fprintf(stderr, "Line: %d: error: previous declaration of \"%s\" at line %d\n",
-                node->line, sym, entry->line);
+        print_location(ctx->err, &ctx->line_index, node->offset);
+        fprintf(ctx->err, "error: previous declaration of \"%s\" at line %u\n",
+                sym->name, line_of_offset(&ctx->line_index, entry->offset));
         return false;
     }
 }
 
 
-bool insert_sym_from_paramdecl_node(sym_table_t* scope, ast_node_t* node) {
+static bool insert_sym_from_paramdecl_node(compiler_ctx_t* ctx,
+    sym_table_t* table, sym_scope_t* scope, ast_node_t* node) {
     ast_node_t* ident = node->as.paramdecl.ident;
-    char* sym =  ident->as.ident.value;
-    sym_entry_t* entry = sym_lookup(scope, sym);
+    atom_t* sym = ident->as.ident.atom;
+    sym_entry_t* entry = lookup_in_scope(table, sym);
 
     if (entry == NULL) {
-        uint32_t pos = hash(sym) % MAX_ENTRIES;
-        sym_entry_t* new_entry = create_sym_entry(sym, SYM_VAR);
-        new_entry->line = node->line;
+        sym_entry_t* new_entry = create_sym_entry(table, sym, SYM_VAR,
+            node->offset);
         new_entry->as.var.type = node->as.paramdecl.type;
         new_entry->as.var.is_array = node->as.paramdecl.is_array;
-
-        new_entry->next = scope->entries[pos];
-        scope->entries[pos] = new_entry;
+        ident->as.ident.entry = new_entry;
+        insert_entry(table, scope, new_entry);
         return true;
     } else {
-        fprintf(stderr, "Line: %d: error: previous declaration of \"%s\" at line %d\n",
-                node->line, sym, entry->line);
+        print_location(ctx->err, &ctx->line_index, node->offset);
+        fprintf(ctx->err, "error: previous declaration of \"%s\" at line %u\n",
+                sym->name, line_of_offset(&ctx->line_index, entry->offset));
         return false;
     }
 }
 
-bool prev_funcdecl_match(sym_table_t* scope, sym_entry_t* entry, ast_node_t *node) {
+static bool prev_funcdecl_match(sym_entry_t* entry, ast_node_t *node) {
     int n = 0;
-    ast_node_t *param = node->as.funcdecl.params->as.paramsdecllist.list->head;
+    ast_node_list_t* params = &node->as.funcdecl.params->as.paramsdecllist.list;
 
     if (entry->as.func.type != node->as.funcdecl.type)
         return false;
 
-    while (param) {
+    for (uint32_t i = 0; i < params->count; i++) {
+        ast_node_t* param = params->items[i];
         n++;
         if (n > entry->as.func.n_params)
             return false;
 
         sym_entry_t* param_entry = entry->as.func.params[n-1];
-        if (strcmp(param_entry->sym, param->as.paramdecl.ident->as.ident.value)
+        if (param_entry->sym != param->as.paramdecl.ident->as.ident.atom
             || param_entry->as.var.type != param->as.paramdecl.type
             || param_entry->as.var.is_array != param->as.paramdecl.is_array) {
                 return false;
         }
-        param = param->next;
     }
 
     return (n == entry->as.func.n_params) ? true : false;
 }
 
-bool insert_sym_from_funcdecl_prototype_node(sym_table_t* scope, ast_node_t *node) {
+bool insert_sym_from_funcdecl_prototype_node(compiler_ctx_t* ctx,
+    sym_table_t* table, ast_node_t *node) {
     ast_node_t* ident = node->as.funcdecl.ident;
-    char* sym =  ident->as.ident.value;
-    sym_entry_t* entry = sym_lookup(scope, sym);
+    atom_t* sym = ident->as.ident.atom;
+    sym_entry_t* entry = sym_lookup(table, sym);
 
     if (entry == NULL) {
-        sym_entry_t* entry = create_sym_entry(sym, SYM_FUNC);
-        entry->line = ident->line;
-        entry->as.func.sym_table = create_sym_table(scope);
+        sym_entry_t* entry = create_sym_entry(table, sym, SYM_FUNC,
+            ident->offset);
+        entry->as.func.scope.accepts_new_var = true;
         entry->as.func.type = node->as.funcdecl.type;
-        entry->as.func.n_params = 0;
-        entry->as.func.params = NULL;
         entry->as.func.defined = false;
-
-        uint32_t pos = hash(sym) % MAX_ENTRIES;
-        entry->next = scope->entries[pos];
-        scope->entries[pos] = entry;
-
-        ast_node_t *param = node->as.funcdecl.params->as.paramsdecllist.list->head;
-        while (param) {
-            insert_sym_from_paramdecl_node(entry->as.func.sym_table, param);
-            entry->as.func.n_params++;
-            entry->as.func.params = realloc(entry->as.func.params,
-                entry->as.func.n_params * sizeof(sym_entry_t*));
-
-            sym_entry_t* param_sym = sym_lookup(entry->as.func.sym_table,
-                param->as.paramdecl.ident->as.ident.value);
-            entry->as.func.params[entry->as.func.n_params-1] = param_sym;
-
-            param = param->next;
+        ident->as.ident.entry = entry;
+        insert_entry(table, &table->globals, entry);
+
+        ast_node_list_t* params =
+            &node->as.funcdecl.params->as.paramsdecllist.list;
+        entry->as.func.n_params = params->count;
+        entry->as.func.params = arena_alloc(&table->arena,
+            params->count * sizeof(sym_entry_t*));
+        // The parameters are checked in a scope of their own, the body binds
+        // them again.
+        open_scope(table);
+        for (uint32_t i = 0; i < params->count; i++) {
+            ast_node_t* param = params->items[i];
+            insert_sym_from_paramdecl_node(ctx, table, &entry->as.func.scope,
+                param);
+            entry->as.func.params[i] = sym_lookup(table,
+                param->as.paramdecl.ident->as.ident.atom);
         }
+        close_scope(table);
         return true;
     } else {
-        if (defining_a_declaration) {
+        if (ctx->defining_a_declaration) {
             return true;
         } else {
-            fprintf(stderr, "Line: %d: error: previous declaration of \"%s\" at line %d\n",
-                node->line, sym, entry->line);
+            print_location(ctx->err, &ctx->line_index, node->offset);
+            fprintf(ctx->err, "error: previous declaration of \"%s\" at line %u\n",
+                sym->name, line_of_offset(&ctx->line_index, entry->offset));
             return false;
         }
     }
 }
 
-bool insert_sym_from_funcdef_node(sym_table_t* scope, ast_node_t *node) {
-    defining_a_declaration = true;
-    char *sym = node->as.funcdecl.ident->as.ident.value;
-    sym_entry_t* entry = sym_lookup(scope, sym);
+bool insert_sym_from_funcdef_node(compiler_ctx_t* ctx, sym_table_t* table,
+    ast_node_t *node) {
+    ctx->defining_a_declaration = true;
+    atom_t* sym = node->as.funcdecl.ident->as.ident.atom;
+    sym_entry_t* entry = sym_lookup(table, sym);
     if (entry == NULL) {
-        insert_sym_from_funcdecl_prototype_node(scope, node);
-        entry = sym_lookup(scope, sym);
+        insert_sym_from_funcdecl_prototype_node(ctx, table, node);
+        entry = sym_lookup(table, sym);
         entry->as.func.defined = true;
-        defining_a_declaration = false;
+        ctx->defining_a_declaration = false;
         return true;
     } else {
         if (entry->as.func.defined) {
-            fprintf(stderr, "Line: %d: error: previous definition of \"%s\" at line %d\n",
-                node->line, sym, entry->line);
-            defining_a_declaration = false;
+            print_location(ctx->err, &ctx->line_index, node->offset);
+            fprintf(ctx->err, "error: previous definition of \"%s\" at line %u\n",
+                sym->name, line_of_offset(&ctx->line_index, entry->offset));
+            ctx->defining_a_declaration = false;
             return false;
         } else {
-            if (prev_funcdecl_match(scope, entry, node)) {
+            if (prev_funcdecl_match(entry, node)) {
                 entry->as.func.defined = true;
-                entry->line = node->line;
-                defining_a_declaration = false;
+                entry->offset = node->offset;
+                ctx->defining_a_declaration = false;
                 return true;
             } else {
-                defining_a_declaration = false;
-                fprintf(stderr,
-                        "Line: %d: error: conflicting with previous declaration of \"%s\" at line %d\n",
-                    node->line, sym, entry->line);
+                ctx->defining_a_declaration = false;
+                print_location(ctx->err, &ctx->line_index, node->offset);
+                fprintf(ctx->err,
+                        "error: conflicting with previous declaration of \"%s\" at line %u\n",
+                    sym->name, line_of_offset(&ctx->line_index, entry->offset));
                 return false;
             }
         }
@@ -207,50 +376,62 @@ static char* type_to_typestr(decl_type_t type) {
     return "unknown";
 }
 
-static void show_only(sym_entry_t* entry) {
+static void show_only(FILE* out, sym_entry_t* entry) {
     if (entry->type == SYM_VAR) {
-        printf("    variable | type: %-4s%s | sym: %-20s\n",
+        fprintf(out, "    variable | type: %-4s%s | sym: %-20s\n",
             type_to_typestr(entry->as.var.type),
             entry->as.var.is_array ? "[]":"  ",
-            entry->sym);
+            entry->sym->name);
 
     } else if (entry->type == SYM_FUNC) {
-        printf("    function | type: %-4s   | sym: %-20s | n_params: %d\n",
+        fprintf(out, "    function | type: %-4s   | sym: %-20s | n_params: %d\n",
             type_to_typestr(entry->as.func.type),
-            entry->sym,
+            entry->sym->name,
             entry->as.func.n_params);
     }
 }
 
-static void do_show_sym_table(sym_table_t* scope) {
-    for (int i = 0; i < MAX_ENTRIES; i++) {
-        if (scope->entries[i] != NULL) {
-            sym_entry_t* entry = scope->entries[i];
-            while (entry) {
-                show_only(entry);
-                entry = entry->next;
-            }
-        }
-    }
-    for (int i = 0; i < MAX_ENTRIES; i++) {
-        if (scope->entries[i] != NULL) {
-            sym_entry_t* entry = scope->entries[i];
-            while (entry) {
-                if (entry->type == SYM_FUNC) {
-                    puts("--------------------------------------------------------------------------------");
-                    printf("Scope: %s\n", entry->sym);
-                    do_show_sym_table(entry->as.func.sym_table);
-
-                }
-                entry = entry->next;
-            }
+static void show_scope(FILE* out, sym_scope_t* scope) {
+    for (sym_entry_t* entry = scope->first; entry; entry = entry->next)
+        show_only(out, entry);
+    for (sym_entry_t* entry = scope->first; entry; entry = entry->next) {
+        if (entry->type == SYM_FUNC) {
+            fputs("--------------------------------------------------------------------------------\n", out);
+            fprintf(out, "Scope: %s\n", entry->sym->name);
+            show_scope(out, &entry->as.func.scope);
         }
     }
 }
 
-void show_sym_table(sym_table_t* scope) {
-    puts("================================= Symbol Table =================================");
-    puts("Scope: <global>");
-    do_show_sym_table(scope);
-    puts("================================================================================\n");
-}
\ No newline at end of file
+void show_sym_table(FILE* out, sym_table_t* table) {
+    fputs("================================= Symbol Table =================================\n", out);
+    fputs("Scope: <global>\n", out);
+    show_scope(out, &table->globals);
+    fputs("================================================================================\n\n", out);
+}
+
+void sym_table_stats(sym_table_t* table, sym_stats_t* stats) {
+    memset(stats, 0, sizeof(sym_stats_t));
+    if (table == NULL)
+        return;
+    stats->entries = table->entries;
+    stats->scopes = 1;
+    sym_scope_t* globals = &table->globals;
+    for (sym_entry_t* entry = globals->first; entry; entry = entry->next) {
+        if (entry->type == SYM_FUNC)
+            stats->scopes++;
+    }
+    stats->slots = table->capacity;
+    stats->names = table->names;
+    uint32_t mask = table->capacity - 1;
+    for (uint32_t i = 0; i < table->capacity; i++) {
+        atom_t* sym = table->slots[i].sym;
+        if (sym == NULL)
+            continue;
+        uint32_t probes = ((i - home_slot(table, sym)) & mask) + 1;
+        stats->probes += probes;
+        if (probes > stats->max_probes)
+            stats->max_probes = probes;
+    }
+    stats->max_depth = table->max_depth;
+}
@@ -1,21 +1,38 @@
 #ifndef cmm_sym_table_h
 #define cmm_sym_table_h
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include "ast.h"
-#define MAX_ENTRIES 1024
+#include "arena.h"
+
+typedef struct compiler_ctx compiler_ctx_t;
 
 typedef enum {
     SYM_FUNC,
     SYM_VAR,
 } sym_type_t;
 
+// The entries declared in a scope, in declaration order.
+typedef struct {
+    struct sym_entry* first;
+    struct sym_entry* last;
+    bool accepts_new_var;
+} sym_scope_t;
+
 typedef struct sym_entry {
+    // The entry declared after this one in the same scope.
     struct sym_entry* next;
+    // While bound, the entry of the same name it hides and the depth of the
+    // scope it is bound in, 0 for globals.
+    struct sym_entry* shadowed;
+    uint32_t depth;
     sym_type_t type;
-    char* sym;
-    uint32_t line;
+    atom_t* sym;
+    uint32_t offset;
+    // Of the first declaration, offset may move to the definition.
+    uint32_t declared_offset;
 
     union {
         struct {
@@ -27,27 +44,78 @@ typedef struct sym_entry {
             decl_type_t type;
             uint32_t n_params;
             struct sym_entry** params;
-            struct _sym_table *sym_table;
+            // The parameters and the locals, bound again for the body.
+            sym_scope_t scope;
             bool defined;
         } func;
     } as;
 
 } sym_entry_t;
 
+// A name and its innermost entry. A name keeps its slot once bound, closing
+// a scope only puts back the entry it hid, so probe sequences never break.
+typedef struct {
+    atom_t* sym;
+    sym_entry_t* entry;
+} sym_binding_t;
 
+// One table for every scope. A name is bound to its innermost entry in an
+// open addressing table with linear probing, the slot coming from its atom
+// id mixed with a seed of the table's own, so names cannot be picked to
+// collide. Opening a scope marks the stack of bound entries, closing it
+// unbinds down to the mark, putting back what was hidden. Entries live in
+// the table's arena.
 typedef struct _sym_table {
-    struct _sym_table* parent;
-    bool accepts_new_var;
-    sym_entry_t* entries[MAX_ENTRIES];
+    // NULL until the first bind, a power of two.
+    sym_binding_t* slots;
+    uint32_t capacity;
+    uint32_t names;
+    uint32_t seed;
+    // The entries bound in open scopes, innermost last. Globals are never
+    // unbound and are not kept here.
+    sym_entry_t** bound;
+    uint32_t bound_count;
+    uint32_t bound_capacity;
+    // Where each open scope begins in bound.
+    uint32_t* marks;
+    uint32_t depth;
+    uint32_t marks_capacity;
+    sym_scope_t globals;
+    arena_t arena;
+    // Reported by --stats.
+    size_t entries;
+    uint32_t max_depth;
 } sym_table_t;
 
-void show_sym_table(sym_table_t* scope);
-sym_table_t* create_sym_table(sym_table_t* parent);
-//bool insert_sym_from_funcdecl_node(sym_table_t* scope, ast_node_t *node, bool prototype);
-bool insert_sym_from_vardecl_node(sym_table_t* scope, ast_node_t* node);
-sym_entry_t* sym_lookup(sym_table_t* scope, char* sym);
+// Reported by --stats. scopes counts the global scope and the function
+// ones. A probe is a slot looked at to find a name.
+typedef struct {
+    size_t entries;
+    uint32_t scopes;
+    uint32_t slots;
+    uint32_t names;
+    size_t probes;
+    uint32_t max_probes;
+    uint32_t max_depth;
+} sym_stats_t;
+
+void show_sym_table(FILE* out, sym_table_t* table);
+sym_table_t* create_sym_table(void);
+sym_table_t* fork_sym_table(const sym_table_t* table);
+void join_sym_table(sym_table_t* table, sym_table_t* fork);
+void free_sym_table(sym_table_t* table);
+void open_scope(sym_table_t* table);
+void close_scope(sym_table_t* table);
+void bind_scope(sym_table_t* table, sym_scope_t* scope);
+sym_entry_t* sym_lookup(sym_table_t* table, atom_t* sym);
+sym_entry_t* sym_lookup_global(sym_table_t* table, atom_t* sym);
+void sym_table_stats(sym_table_t* table, sym_stats_t* stats);
 
-bool insert_sym_from_funcdecl_prototype_node(sym_table_t* scope, ast_node_t *node);
-bool insert_sym_from_funcdef_node(sym_table_t* scope, ast_node_t *node);
+bool insert_sym_from_vardecl_node(compiler_ctx_t* ctx, sym_table_t* table,
+    sym_scope_t* scope, ast_node_t* node);
+bool insert_sym_from_funcdecl_prototype_node(compiler_ctx_t* ctx,
+    sym_table_t* table, ast_node_t *node);
+bool insert_sym_from_funcdef_node(compiler_ctx_t* ctx, sym_table_t* table,
+    ast_node_t *node);
 
-#endif
\ No newline at end of file
+#endif
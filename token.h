@@ -36,17 +36,49 @@ typedef enum {
     TOKEN_EOF
 } token_type_t;
 
+// Reserved words. The scanner builds its keyword lookup from this list.
+#define KEYWORDS(X)             \
+    X("void",   TOKEN_VOID)     \
+    X("char",   TOKEN_CHAR)     \
+    X("int",    TOKEN_INT)      \
+    X("extern", TOKEN_EXTERN)   \
+    X("if",     TOKEN_IF)       \
+    X("else",   TOKEN_ELSE)     \
+    X("while",  TOKEN_WHILE)    \
+    X("for",    TOKEN_FOR)      \
+    X("return", TOKEN_RETURN)
+
 typedef struct {
     token_type_t type;
     const char* start;
     uint32_t length;
-    uint32_t line;
+    // Of start in the source, for the nodes built from the token.
+    uint32_t offset;
+    // Decoded by the scanner: the value of a number, the character of a
+    // char literal, or where a string's text starts in the literal pool.
+    uint32_t value;
 } token_t;
 
+// The text of string literals with their escapes decoded. Each is stored
+// as its length, a uint32_t, followed by the text and a '\0'.
+typedef struct {
+    char* bytes;
+    uint32_t size;
+    uint32_t capacity;
+} literal_pool_t;
+
+// Tokens are kept as parallel arrays so the parser only touches the bytes it
+// needs: a one byte type, the offset of the lexeme in the source, its length
+// and its decoded value. Lines are not stored, see line_index.h.
 typedef struct {
     uint32_t count;
     uint32_t capacity;
-    token_t* tokens;
+    uint8_t* types;
+    uint32_t* offsets;
+    uint32_t* lengths;
+    uint32_t* values;
+    literal_pool_t literals;
+    const char* source;
     bool had_error;
 } token_stream_t;
 